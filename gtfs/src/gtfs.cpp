@@ -14,6 +14,16 @@
 #include <unordered_map>
 #include <utility>
 #include <sys/mman.h>
+#include <climits>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sched.h>
+#include <chrono>
+#include <algorithm>
+#ifdef __linux__
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#endif
 
 
 #define VERBOSE_PRINT(verbose, str...) do { \
@@ -23,7 +33,669 @@
 int do_verbose;
 unordered_map<string, gtfs_t*> directories;
 
-gtfs_t* gtfs_init(string directory, int verbose_flag) {
+static int gtfs_real_open(const char* path, int flags, mode_t mode) {
+    return open(path, flags, mode);
+}
+
+gtfs_syscalls_t gtfs_sys = { gtfs_real_open, pwrite, ftruncate };
+
+//! Grow the backing file and the mapping of fl so that at least length bytes are addressable.
+//! Capacity doubles each time so that repeated appends are amortized O(1).
+static int gtfs_grow_mapping(file_t* fl, int length) {
+    if (length <= fl->mapped_length) {
+        return 0;
+    }
+    long new_length = fl->mapped_length > 0 ? fl->mapped_length : getpagesize();
+    while (new_length < length) {
+        new_length *= 2;
+    }
+    if (new_length > INT_MAX) {
+        new_length = INT_MAX;
+    }
+    if (gtfs_sys.ftruncate(fl->fd, new_length) == -1) {
+        VERBOSE_PRINT(do_verbose, "File could not be resized\n");
+        return -1;
+    }
+#ifdef __linux__
+    void* mapped_file = mremap(fl->mapped_file, fl->mapped_length, new_length, MREMAP_MAYMOVE);
+#else
+    //! No mremap: the old mapping holds unsynced writes the file does not have, carry them over to a
+    //! new one before letting it go, and keep it if the new one cannot be made
+    void* mapped_file = mmap(NULL, new_length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fl->fd, 0);
+    if (mapped_file != MAP_FAILED) {
+        memcpy(mapped_file, fl->mapped_file, fl->mapped_length);
+        munmap(fl->mapped_file, fl->mapped_length);
+    }
+#endif
+    if (mapped_file == MAP_FAILED) {
+        VERBOSE_PRINT(do_verbose, "Memory mapping failed\n");
+        return -1;
+    }
+    fl->mapped_file = mapped_file;
+    fl->mapped_length = new_length;
+    return 0;
+}
+
+//! Sync the oldest pending writes until bytes of them are synced. Unlike gtfs_clean_n_bytes the writes
+//! stay in their file's log, since the caller still holds them, and no log is truncated.
+static void gtfs_flush_n_bytes(gtfs_t* gtfs, int bytes) {
+    for (auto it = gtfs->map.begin(); it != gtfs->map.end() and bytes > 0; ++it) {
+        file_t* fl = it->second;
+        for (auto log_it = fl->log.begin(); log_it != fl->log.end() and bytes > 0; ++log_it) {
+            write_t* write_step = *log_it;
+            if (write_step->synced > 0) {
+                continue;
+            }
+            if (write_step->length < bytes) {
+                bytes -= write_step->length;
+                gtfs_sync_write_file(write_step);
+            } else {
+                gtfs_sync_write_file_n_bytes(write_step, bytes);
+                bytes = 0;
+            }
+        }
+    }
+}
+
+//! Reserve room in the memory budget for the redo and undo copies of a write of length bytes.
+//! Close to the budget, pending writes are flushed first; if that is not enough the backpressure
+//! policy decides. Sets spill when the undo copy has to go to the scratch file.
+static int gtfs_reserve_memory(gtfs_t* gtfs, int length, int* spill) {
+    long needed = 2L * length;
+    *spill = 0;
+    pthread_mutex_lock(&gtfs->mem_lock);
+    if (gtfs->mem_budget > 0 and gtfs->mem_used + needed > gtfs->mem_budget * GTFS_MEM_HIGH_WATERMARK / 100) {
+        //! Each synced byte frees both its redo and its undo copy
+        long excess = gtfs->mem_used + needed - gtfs->mem_budget * GTFS_MEM_LOW_WATERMARK / 100;
+        pthread_mutex_unlock(&gtfs->mem_lock);
+        VERBOSE_PRINT(do_verbose, "Memory budget almost full, flushing " << excess / 2 << " bytes\n");
+        gtfs_flush_n_bytes(gtfs, (int) min(excess / 2 + 1, (long) INT_MAX));
+        pthread_mutex_lock(&gtfs->mem_lock);
+    }
+    while (gtfs->mem_budget > 0 and gtfs->mem_used + needed > gtfs->mem_budget) {
+        if (gtfs->backpressure == GTFS_BACKPRESSURE_SPILL and gtfs->mem_used + length <= gtfs->mem_budget) {
+            *spill = 1;
+            needed = length;
+            break;
+        }
+        if (gtfs->backpressure == GTFS_BACKPRESSURE_BLOCK and needed <= gtfs->mem_budget) {
+            pthread_cond_wait(&gtfs->mem_cond, &gtfs->mem_lock);
+            continue;
+        }
+        pthread_mutex_unlock(&gtfs->mem_lock);
+        VERBOSE_PRINT(do_verbose, "Memory budget exceeded\n");
+        return -1;
+    }
+    gtfs->mem_used += needed;
+    pthread_mutex_unlock(&gtfs->mem_lock);
+    return 0;
+}
+
+//! Give back bytes of the memory budget and wake up writers blocked on it
+static void gtfs_release_memory(gtfs_t* gtfs, long bytes) {
+    pthread_mutex_lock(&gtfs->mem_lock);
+    gtfs->mem_used -= bytes;
+    pthread_cond_broadcast(&gtfs->mem_cond);
+    pthread_mutex_unlock(&gtfs->mem_lock);
+}
+
+//! Free the in-memory redo and undo copies of a write
+static void gtfs_free_write_data(write_t* write_id) {
+    long bytes = write_id->data ? write_id->length : 0;
+    if (write_id->overwritten_data) {
+        bytes += write_id->overwritten_length;
+    }
+    free(write_id->data);
+    free(write_id->overwritten_data);
+    write_id->data = nullptr;
+    write_id->overwritten_data = nullptr;
+    gtfs_release_memory(write_id->gtfs, bytes);
+}
+
+//! Free a write, emptying the gtfs::Write handle still holding it if there is one
+static void gtfs_delete_write(write_t* write_id) {
+    if (write_id->handle) {
+        *write_id->handle = nullptr;
+    }
+    delete write_id;
+}
+
+static long gtfs_now_ms() {
+    return chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static int gtfs_datasync(int fd) {
+#ifdef __linux__
+    return fdatasync(fd);
+#else
+    return fsync(fd);
+#endif
+}
+
+static string gtfs_log_segment_path(file_t* fl, int index) {
+    return fl->log_file.substr(0, fl->log_file.length() - 4) + "-" + to_string(index) + ".txt";
+}
+
+//! Payload bytes of the records of one generation at the start of a segment
+static long gtfs_log_segment_length(int fd, uint64_t generation) {
+    long length = 0;
+    long offset = sizeof(log_segment_header_t);
+    log_record_header_t header;
+    while (offset + (long) sizeof(header) <= GTFS_LOG_SEGMENT_SIZE
+            and pread(fd, &header, sizeof(header), offset) == sizeof(header)
+            and header.length > 0 and header.generation == (uint32_t) generation
+            and offset + (long) sizeof(header) + header.length <= GTFS_LOG_SEGMENT_SIZE) {
+        length += header.length;
+        offset += sizeof(header) + header.length;
+    }
+    return length;
+}
+
+//! Look up the segments left by an earlier process. Free ones are reused, live ones still hold a log
+//! nobody truncated and stay in it, oldest first. Generations continue after the last one used in any.
+static void gtfs_log_find_segments(file_t* fl) {
+    fl->log_segments = 0;
+    vector<pair<uint64_t, int>> live;
+    for (;;) {
+        int fd = open(gtfs_log_segment_path(fl, fl->log_segments).c_str(), O_RDONLY);
+        if (fd == -1) {
+            break;
+        }
+        log_segment_header_t header;
+        bool valid = pread(fd, &header, sizeof(header), 0) == sizeof(header) and header.magic == GTFS_LOG_MAGIC;
+        if (valid) {
+            fl->log_generation = max(fl->log_generation, header.generation);
+        }
+        if (valid and !(header.flags & GTFS_LOG_SEGMENT_FREE) and header.generation != 0) {
+            fl->log_length += gtfs_log_segment_length(fd, header.generation);
+            live.push_back(make_pair(header.generation, fl->log_segments));
+        } else {
+            fl->log_free.push_back(fl->log_segments);
+        }
+        close(fd);
+        fl->log_segments++;
+    }
+    //! Appending goes on in a new segment after them
+    sort(live.begin(), live.end());
+    for (auto segment = live.begin(); segment != live.end(); ++segment) {
+        fl->log_active.push_back(segment->second);
+    }
+}
+
+static int gtfs_log_write_header(int fd, uint64_t generation, uint32_t flags) {
+    log_segment_header_t header = { GTFS_LOG_MAGIC, flags, generation };
+    return gtfs_sys.pwrite(fd, &header, sizeof(header), 0) == sizeof(header) ? 0 : -1;
+}
+
+//! Make a free or newly preallocated segment current under the next generation
+static int gtfs_log_activate(file_t* fl) {
+    bool recycled = !fl->log_free.empty();
+    int index = recycled ? fl->log_free.back() : fl->log_segments;
+    int dsync = fl->gtfs->durability == GTFS_DURABILITY_DSYNC ? O_DSYNC : 0;
+    int fd = gtfs_sys.open(gtfs_log_segment_path(fl, index).c_str(), O_RDWR | O_CREAT | dsync, 0666);
+    if (fd == -1) {
+        VERBOSE_PRINT(do_verbose, "Failed to open log segment!\n");
+        return -1;
+    }
+    if (!recycled) {
+#ifdef __linux__
+        int allocated = fallocate(fd, 0, 0, GTFS_LOG_SEGMENT_SIZE);
+#else
+        int allocated = gtfs_sys.ftruncate(fd, GTFS_LOG_SEGMENT_SIZE);
+#endif
+        if (allocated == -1) {
+            VERBOSE_PRINT(do_verbose, "Failed to preallocate log segment!\n");
+            close(fd);
+            return -1;
+        }
+    }
+    if (gtfs_log_write_header(fd, fl->log_generation + 1, 0) == -1) {
+        VERBOSE_PRINT(do_verbose, "Failed to write log segment header!\n");
+        close(fd);
+        return -1;
+    }
+    if (recycled) {
+        fl->log_free.pop_back();
+    } else {
+        fl->log_segments++;
+    }
+    fl->log_generation++;
+    fl->log_active.push_back(index);
+    fl->log_fd = fd;
+    fl->log_fd_dsync = dsync;
+    fl->log_offset = sizeof(log_segment_header_t);
+    return 0;
+}
+
+//! Seal the current segment: make it durable and close it, a new one is activated on the next append
+static void gtfs_log_seal(file_t* fl) {
+    if (fl->log_fd != -1) {
+        gtfs_datasync(fl->log_fd);
+        close(fl->log_fd);
+        fl->log_fd = -1;
+    }
+}
+
+//! Append a record to the current log segment, moving to the next one when it is full.
+//! The payload is written before the header that makes it valid. Caller holds draining.
+static int gtfs_log_append(file_t* fl, const char* data, size_t length) {
+    int dsync = fl->gtfs->durability == GTFS_DURABILITY_DSYNC ? O_DSYNC : 0;
+    if (fl->log_fd != -1 and dsync != fl->log_fd_dsync) {
+        //! The durability level changed, reopen the current segment with the right flags
+        int fd = gtfs_sys.open(gtfs_log_segment_path(fl, fl->log_active.back()).c_str(), O_RDWR | dsync, 0666);
+        if (fd != -1) {
+            close(fl->log_fd);
+            fl->log_fd = fd;
+            fl->log_fd_dsync = dsync;
+        }
+    }
+    do {
+        if (fl->log_fd == -1 or fl->log_offset + (long) sizeof(log_record_header_t) >= GTFS_LOG_SEGMENT_SIZE) {
+            gtfs_log_seal(fl);
+            if (gtfs_log_activate(fl) == -1) {
+                return -1;
+            }
+        }
+        size_t chunk = min(length, (size_t) (GTFS_LOG_SEGMENT_SIZE - fl->log_offset - sizeof(log_record_header_t)));
+        log_record_header_t header = { (uint32_t) chunk, (uint32_t) fl->log_generation };
+        if (gtfs_sys.pwrite(fl->log_fd, data, chunk, fl->log_offset + sizeof(header)) != (ssize_t) chunk
+                or gtfs_sys.pwrite(fl->log_fd, &header, sizeof(header), fl->log_offset) != sizeof(header)) {
+            VERBOSE_PRINT(do_verbose, "Failed to write to the disk memory!\n");
+            return -1;
+        }
+        fl->log_offset += sizeof(header) + chunk;
+        fl->log_length += chunk;
+        data += chunk;
+        length -= chunk;
+    } while (length > 0);
+    return 0;
+}
+
+//! Zero a drained record, so that a producer's header slot reads as not ready until it writes it
+//! even when the previous lap left payload bytes there
+static void gtfs_log_ring_clear(log_ring_t* ring, unsigned long pos, unsigned long size) {
+    unsigned long start = pos % GTFS_LOG_RING_SIZE;
+    unsigned long first = min(size, GTFS_LOG_RING_SIZE - start);
+    memset(ring->buffer + start, 0, first);
+    memset(ring->buffer, 0, size - first);
+}
+
+//! Consumer side of the log ring, the caller holds draining. Moves completed records to the log
+//! file in order, stopping at the first one still being filled unless it has to reach until.
+//! A failed append is latched in log_error for the syncs and barriers to report.
+static void gtfs_log_ring_drain_locked(file_t* fl, unsigned long until) {
+    log_ring_t* ring = &fl->log_ring;
+    unsigned long pos = ring->drained.load(memory_order_relaxed);
+    while (pos != ring->reserved.load(memory_order_acquire)) {
+        char* header = ring->buffer + pos % GTFS_LOG_RING_SIZE;
+        atomic_ref<uint32_t> ready(*(uint32_t*) (header + 4));
+        if (!ready.load(memory_order_acquire)) {
+            if (pos < until) {
+                sched_yield();
+                continue;
+            }
+            break;
+        }
+        uint32_t length = *(uint32_t*) header;
+        unsigned long start = (pos + 8) % GTFS_LOG_RING_SIZE;
+        unsigned long first = min((unsigned long) length, GTFS_LOG_RING_SIZE - start);
+        int ret = 0;
+        if (first < length) {
+            //! Wrapped around the end of the ring, put it back together so it stays one log record
+            vector<char> record(ring->buffer + start, ring->buffer + start + first);
+            record.insert(record.end(), ring->buffer, ring->buffer + (length - first));
+            ret = gtfs_log_append(fl, record.data(), length);
+        } else if (length > 0) {
+            ret = gtfs_log_append(fl, ring->buffer + start, length);
+        }
+        if (ret == -1) {
+            fl->log_error = 1;
+        }
+        gtfs_log_ring_clear(ring, pos, GTFS_LOG_RECORD_SIZE(length));
+        pos += GTFS_LOG_RECORD_SIZE(length);
+        ring->drained.store(pos, memory_order_release);
+    }
+}
+
+//! Drain the log ring if no other thread is doing it already
+static void gtfs_log_ring_drain(file_t* fl) {
+    log_ring_t* ring = &fl->log_ring;
+    //! Sequentially consistent with the ready store in gtfs_log_ring_append, so that either the producer
+    //! sees draining clear or the drainer sees its record ready
+    while (!ring->draining.test_and_set()) {
+        gtfs_log_ring_drain_locked(fl, 0);
+        ring->draining.clear();
+        //! A record completed after the drain stopped but before draining was cleared would be left behind
+        unsigned long pos = ring->drained.load();
+        if (pos == ring->reserved.load()
+                or !atomic_ref<uint32_t>(*(uint32_t*) (ring->buffer + pos % GTFS_LOG_RING_SIZE + 4)).load()) {
+            return;
+        }
+    }
+}
+
+//! Wait until every record reserved so far is in the log file
+static void gtfs_log_ring_flush(file_t* fl) {
+    log_ring_t* ring = &fl->log_ring;
+    while (ring->draining.test_and_set(memory_order_acquire)) {
+        sched_yield();
+    }
+    gtfs_log_ring_drain_locked(fl, ring->reserved.load(memory_order_acquire));
+    ring->draining.clear(memory_order_release);
+}
+
+//! Flush the log ring and make the current segment durable
+static int gtfs_log_sync(file_t* fl) {
+    log_ring_t* ring = &fl->log_ring;
+    while (ring->draining.test_and_set(memory_order_acquire)) {
+        sched_yield();
+    }
+    gtfs_log_ring_drain_locked(fl, ring->reserved.load(memory_order_acquire));
+    int ret = fl->log_fd == -1 ? 0 : gtfs_datasync(fl->log_fd);
+    ring->draining.clear(memory_order_release);
+    return fl->log_error ? -1 : ret;
+}
+
+//! Empty the log: every segment in use is marked free in place and goes back to the free list.
+//! No file is removed, created or resized.
+static void gtfs_log_truncate(file_t* fl) {
+    log_ring_t* ring = &fl->log_ring;
+    while (ring->draining.test_and_set(memory_order_acquire)) {
+        sched_yield();
+    }
+    gtfs_log_ring_drain_locked(fl, ring->reserved.load(memory_order_acquire));
+    if (fl->log_fd != -1) {
+        close(fl->log_fd);
+        fl->log_fd = -1;
+    }
+    //! A checkpoint copying these segments must be done before they can be recycled
+    pthread_mutex_lock(&fl->checkpoint_log_lock);
+    pthread_mutex_unlock(&fl->checkpoint_log_lock);
+    for (auto index = fl->log_active.begin(); index != fl->log_active.end(); ++index) {
+        int fd = gtfs_sys.open(gtfs_log_segment_path(fl, *index).c_str(), O_RDWR, 0666);
+        if (fd != -1) {
+            gtfs_log_write_header(fd, fl->log_generation, GTFS_LOG_SEGMENT_FREE);
+            close(fd);
+        }
+        fl->log_free.push_back(*index);
+    }
+    fl->log_active.clear();
+    fl->log_length = 0;
+    fl->log_error = 0;
+    ring->draining.clear(memory_order_release);
+}
+
+//! Producer side of the log ring: reserve room for a record, fill it in place and try to drain
+static int gtfs_log_ring_append(file_t* fl, const char* data, int length) {
+    log_ring_t* ring = &fl->log_ring;
+    unsigned long size = GTFS_LOG_RECORD_SIZE(length);
+    if (size > GTFS_LOG_RING_SIZE) {
+        //! Too big for the ring: become the consumer, drain what is ahead and write it directly
+        while (ring->draining.test_and_set(memory_order_acquire)) {
+            sched_yield();
+        }
+        gtfs_log_ring_drain_locked(fl, ring->reserved.load(memory_order_acquire));
+        if (gtfs_log_append(fl, data, length) == -1) {
+            fl->log_error = 1;
+        }
+        ring->draining.clear(memory_order_release);
+        return fl->log_error ? -1 : 0;
+    }
+    unsigned long pos = ring->reserved.fetch_add(size, memory_order_acq_rel);
+    while (pos + size - ring->drained.load(memory_order_acquire) > GTFS_LOG_RING_SIZE) {
+        gtfs_log_ring_drain(fl);
+        sched_yield();
+    }
+    char* header = ring->buffer + pos % GTFS_LOG_RING_SIZE;
+    *(uint32_t*) header = length;
+    unsigned long start = (pos + 8) % GTFS_LOG_RING_SIZE;
+    unsigned long first = min((unsigned long) length, GTFS_LOG_RING_SIZE - start);
+    memcpy(ring->buffer + start, data, first);
+    memcpy(ring->buffer, data + first, length - first);
+    atomic_ref<uint32_t>(*(uint32_t*) (header + 4)).store(1);
+    gtfs_log_ring_drain(fl);
+    if (fl->log_error) {
+        VERBOSE_PRINT(do_verbose, "Failed to append to the log of " << fl->filename << "\n");
+        return -1;
+    }
+    return 0;
+}
+
+//! Flush barrier: make every write committed so far durable and advance durable_lsn past it.
+//! Only one barrier runs at a time; a caller whose commits were covered by the previous one returns right away.
+static int gtfs_barrier(gtfs_t* gtfs) {
+    long target = gtfs->committed_lsn.load();
+    pthread_mutex_lock(&gtfs->flush_lock);
+    if (gtfs->durable_lsn.load() >= target) {
+        pthread_mutex_unlock(&gtfs->flush_lock);
+        return 0;
+    }
+    //! Everything committed up to here has been written, pick it up in this group too
+    target = gtfs->committed_lsn.load();
+    gtfs->unflushed_bytes = 0;
+    int ret = 0;
+    for (auto it = gtfs->map.begin(); it != gtfs->map.end(); ++it) {
+        file_t* fl = it->second;
+        if (!fl->dirty.exchange(0)) {
+            continue;
+        }
+        if (gtfs_datasync(fl->fd) == -1 or gtfs_log_sync(fl) == -1) {
+            VERBOSE_PRINT(do_verbose, "Failed to flush " << fl->filename << "\n");
+            fl->dirty = 1;
+            ret = -1;
+        }
+    }
+    if (ret == 0) {
+        gtfs->durable_lsn = target;
+    }
+    gtfs->last_flush_ms = gtfs_now_ms();
+    pthread_mutex_unlock(&gtfs->flush_lock);
+    return ret;
+}
+
+//! Path of the snapshot file kept next to a file
+static string gtfs_snapshot_path(const string& path) {
+    return path.substr(0, path.length() - 4) + "-snap.txt";
+}
+
+//! Map the snapshot header of a file, dropping whatever a crashed writer left in it
+static gtfs_snapshot_header_t* gtfs_snapshot_create(file_t* fl) {
+    int fd = gtfs_sys.open(gtfs_snapshot_path(fl->filename).c_str(), O_RDWR | O_CREAT, 0666);
+    if (fd == -1) {
+        return nullptr;
+    }
+    if (gtfs_sys.ftruncate(fd, sizeof(gtfs_snapshot_header_t)) == -1) {
+        close(fd);
+        return nullptr;
+    }
+    void* mapped = mmap(NULL, sizeof(gtfs_snapshot_header_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        return nullptr;
+    }
+    gtfs_snapshot_header_t* snapshot = (gtfs_snapshot_header_t*) mapped;
+    snapshot->writers = 0;
+    snapshot->file_length = fl->file_length;
+    snapshot->lsn = fl->gtfs->committed_lsn.load();
+    snapshot->seq++;
+    return snapshot;
+}
+
+//! Snapshot readers retry while a sync is between here and gtfs_snapshot_end
+static void gtfs_snapshot_begin(file_t* fl) {
+    fl->snapshot->writers++;
+}
+
+static void gtfs_snapshot_end(write_t* write_id, int bytes) {
+    gtfs_snapshot_header_t* snapshot = write_id->file->snapshot;
+    int end = 0;
+    int pos = 0;
+    for (auto range = write_id->ranges.begin(); range != write_id->ranges.end() and pos < bytes; ++range) {
+        end = max(end, range->first + min(range->second, bytes - pos));
+        pos += range->second;
+    }
+    int32_t length = snapshot->file_length.load();
+    while (length < end and !snapshot->file_length.compare_exchange_weak(length, end)) {
+    }
+    int64_t committed = write_id->gtfs->committed_lsn.load();
+    int64_t lsn = snapshot->lsn.load();
+    while (lsn < committed and !snapshot->lsn.compare_exchange_weak(lsn, committed)) {
+    }
+    snapshot->seq++;
+    snapshot->writers--;
+}
+
+//! Copy a range between two files, letting the kernel share or copy the blocks when it can
+static int gtfs_copy_range(int from, int to, long offset, long length) {
+#ifdef __linux__
+    loff_t in = offset;
+    loff_t out = offset;
+    while (length > 0) {
+        ssize_t copied = copy_file_range(from, &in, to, &out, length, 0);
+        if (copied <= 0) {
+            break;
+        }
+        length -= copied;
+    }
+    offset = in;
+#endif
+    char buf[1 << 16];
+    while (length > 0) {
+        ssize_t got = pread(from, buf, min(length, (long) sizeof(buf)), offset);
+        if (got <= 0 or gtfs_sys.pwrite(to, buf, got, offset) != got) {
+            return -1;
+        }
+        offset += got;
+        length -= got;
+    }
+    return 0;
+}
+
+//! Make to share every block of from, only where the filesystem supports reflinks
+static int gtfs_clone_file(int from, int to) {
+#ifdef FICLONE
+    return ioctl(to, FICLONE, from);
+#else
+    return -1;
+#endif
+}
+
+//! Copy one extent the running checkpoint still needs, with checkpoint_lock held
+static void gtfs_checkpoint_extent(file_t* fl, size_t extent) {
+    fl->checkpoint_pending[extent] = 0;
+    long offset = (long) extent * GTFS_CHECKPOINT_EXTENT;
+    long length = min((long) GTFS_CHECKPOINT_EXTENT, fl->checkpoint_length - offset);
+    if (length > 0 and gtfs_copy_range(fl->checkpoint_src_fd, fl->checkpoint_dest_fd, offset, length) == -1) {
+        fl->checkpoint_error = 1;
+    }
+}
+
+//! Syncs hold off a checkpoint's cut until they have their LSN. After a cut they save the extents
+//! they are about to overwrite, if the checkpoint did not copy them yet, and mark them dirty for the next one.
+static void gtfs_checkpoint_begin(write_t* write_id, int bytes) {
+    file_t* fl = write_id->file;
+    pthread_rwlock_rdlock(&write_id->gtfs->checkpoint_lock);
+    pthread_mutex_lock(&fl->checkpoint_lock);
+    int pos = 0;
+    for (auto range = write_id->ranges.begin(); range != write_id->ranges.end() and pos < bytes; ++range) {
+        int length = min(range->second, bytes - pos);
+        if (length > 0) {
+            size_t first = range->first / GTFS_CHECKPOINT_EXTENT;
+            size_t last = (range->first + length - 1) / GTFS_CHECKPOINT_EXTENT;
+            if (last >= fl->checkpoint_dirty.size()) {
+                fl->checkpoint_dirty.resize(last + 1);
+            }
+            for (size_t extent = first; extent <= last; extent++) {
+                if (extent < fl->checkpoint_pending.size() and fl->checkpoint_pending[extent]) {
+                    gtfs_checkpoint_extent(fl, extent);
+                }
+                fl->checkpoint_dirty[extent] = 1;
+            }
+        }
+        pos += length;
+    }
+    pthread_mutex_unlock(&fl->checkpoint_lock);
+}
+
+static void gtfs_checkpoint_end(write_t* write_id) {
+    pthread_rwlock_unlock(&write_id->gtfs->checkpoint_lock);
+}
+
+//! Hand out the LSN of a committed write and queue it for the standby under the same lock, so the
+//! queue is in LSN order. Replication is asynchronous: the replication thread does the sending, and a
+//! standby that is gone or too far behind is dropped while the primary carries on.
+static void gtfs_ship_write(write_t* write_id, int bytes) {
+    gtfs_t* gtfs = write_id->gtfs;
+    string name = write_id->file->filename.substr(gtfs->dirname.length() + 1);
+    vector<pair<int, int>> ranges;
+    int pos = 0;
+    for (auto range = write_id->ranges.begin(); range != write_id->ranges.end() and pos < bytes; ++range) {
+        int length = min(range->second, bytes - pos);
+        ranges.push_back(make_pair(range->first, length));
+        pos += length;
+    }
+    size_t ranges_length = ranges.size() * sizeof(pair<int, int>);
+    vector<char> buf(sizeof(gtfs_repl_record_t) + name.length() + ranges_length + bytes);
+    char* tail = buf.data() + sizeof(gtfs_repl_record_t);
+    memcpy(tail, name.c_str(), name.length());
+    memcpy(tail + name.length(), ranges.data(), ranges_length);
+    memcpy(tail + name.length() + ranges_length, write_id->data, bytes);
+
+    pthread_mutex_lock(&gtfs->repl_lock);
+    write_id->lsn = ++gtfs->committed_lsn;
+    if (gtfs->repl_fd >= 0) {
+        gtfs_repl_record_t record = { (int) name.length(), (int) ranges.size(), write_id->lsn };
+        memcpy(buf.data(), &record, sizeof(record));
+        if (gtfs->repl_queued_bytes + (long) buf.size() > GTFS_REPL_QUEUE_BYTES) {
+            //! The replication thread fails its next send and drops the standby
+            VERBOSE_PRINT(do_verbose, "Standby fell too far behind, stopping replication\n");
+            shutdown(gtfs->repl_fd, SHUT_RDWR);
+        } else {
+            gtfs->repl_queued_bytes += buf.size();
+            gtfs->repl_queue.push_back(std::move(buf));
+            pthread_cond_signal(&gtfs->repl_cond);
+        }
+    }
+    pthread_mutex_unlock(&gtfs->repl_lock);
+}
+
+//! Record a write as committed and make it as durable as the gtfs_t's durability level asks
+static int gtfs_commit(write_t* write_id, int bytes) {
+    gtfs_t* gtfs = write_id->gtfs;
+    write_id->file->dirty = 1;
+    if (gtfs->durability == GTFS_DURABILITY_DSYNC) {
+        //! The file write was O_DSYNC already, the log append is once the ring is drained
+        gtfs_log_ring_flush(write_id->file);
+    }
+    if (gtfs->repl_fd >= 0) {
+        gtfs_ship_write(write_id, bytes);
+    } else {
+        write_id->lsn = ++gtfs->committed_lsn;
+    }
+    gtfs_snapshot_end(write_id, bytes);
+    gtfs_checkpoint_end(write_id);
+    long unflushed = gtfs->unflushed_bytes += bytes;
+    switch (gtfs->durability) {
+    case GTFS_DURABILITY_PERIODIC:
+        if ((gtfs->flush_interval_bytes > 0 and unflushed >= gtfs->flush_interval_bytes)
+                or (gtfs->flush_interval_ms > 0 and gtfs_now_ms() - gtfs->last_flush_ms >= gtfs->flush_interval_ms)) {
+            return gtfs_barrier(gtfs);
+        }
+        break;
+    case GTFS_DURABILITY_GROUP:
+        return gtfs_barrier(gtfs);
+    case GTFS_DURABILITY_DSYNC: {
+        //! LSNs are handed out after the writes are done, so every smaller one is durable as well
+        long durable = gtfs->durable_lsn.load();
+        while (durable < write_id->lsn and !gtfs->durable_lsn.compare_exchange_weak(durable, write_id->lsn)) {
+        }
+        break;
+    }
+    }
+    return 0;
+}
+
+gtfs_t* gtfs_init(const string& directory, int verbose_flag) {
     do_verbose = verbose_flag;
     VERBOSE_PRINT(do_verbose, "Initializing GTFileSystem inside directory " << directory << "\n");
     // TODO: Add locking mechanism to prevent race condition when creating a GTFS
@@ -32,8 +704,45 @@ gtfs_t* gtfs_init(string directory, int verbose_flag) {
         VERBOSE_PRINT(do_verbose, "Success\n"); //On success returns non NULL.
         return map_fs->second;
     }
-    gtfs* gtfs = new gtfs_t;
+    gtfs_t* gtfs = new gtfs_t;
     gtfs->dirname = directory;
+    gtfs->mem_budget = 0;
+    gtfs->mem_used = 0;
+    gtfs->backpressure = GTFS_BACKPRESSURE_BLOCK;
+    pthread_mutex_init(&gtfs->mem_lock, NULL);
+    pthread_cond_init(&gtfs->mem_cond, NULL);
+    gtfs->spill_fd = -1;
+    gtfs->spill_end = 0;
+    gtfs->repl_fd = -1;
+    gtfs->repl_running = 0;
+    gtfs->repl_stop = 0;
+    pthread_mutex_init(&gtfs->repl_lock, NULL);
+    pthread_cond_init(&gtfs->repl_cond, NULL);
+    gtfs->repl_queued_bytes = 0;
+    gtfs->repl_lsn = 0;
+    gtfs->standby = 0;
+    gtfs->standby_listen_fd = -1;
+    gtfs->standby_conn_fd = -1;
+    pthread_mutex_init(&gtfs->standby_lock, NULL);
+    gtfs->durability = GTFS_DURABILITY_BUFFERED;
+    gtfs->flush_interval_ms = 0;
+    gtfs->flush_interval_bytes = 0;
+    gtfs->committed_lsn = 0;
+    gtfs->durable_lsn = 0;
+    gtfs->unflushed_bytes = 0;
+    gtfs->last_flush_ms = gtfs_now_ms();
+    pthread_mutex_init(&gtfs->flush_lock, NULL);
+    pthread_cond_init(&gtfs->flusher_cond, NULL);
+    gtfs->flusher_running = 0;
+    gtfs->flusher_stop = 0;
+    pthread_rwlockattr_t checkpoint_attr;
+    pthread_rwlockattr_init(&checkpoint_attr);
+#ifdef __linux__
+    //! A steady stream of syncs must not keep a checkpoint from ever taking its cut
+    pthread_rwlockattr_setkind_np(&checkpoint_attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+    pthread_rwlock_init(&gtfs->checkpoint_lock, &checkpoint_attr);
+    pthread_rwlockattr_destroy(&checkpoint_attr);
 
     //! Check if the directory already exists, if not create it
     if (mkdir(directory.c_str(), 0755) == -1) {
@@ -66,17 +775,27 @@ int gtfs_clean(gtfs_t *gtfs) {
             if (write_step->synced <= 0) {
                 gtfs_sync_write_file(write_step);
             }
-            free(write_step);
+            gtfs_delete_write(write_step);
         }
         value->log.clear();
-        remove(value->log_file.c_str());
-        open(value->log_file.c_str(), O_CREAT, 0666);
+    }
+    //! The files must not lose what the logs are about to forget
+    if (gtfs->durability != GTFS_DURABILITY_BUFFERED) {
+        gtfs_barrier(gtfs);
+    }
+    for (auto it = gtfs->map.begin(); it != gtfs->map.end(); ++it) {
+        gtfs_log_truncate(it->second);
+    }
+    //! Nothing is pending anymore, so no undo copy in the scratch file is needed
+    if (gtfs->spill_fd >= 0) {
+        gtfs_sys.ftruncate(gtfs->spill_fd, 0);
+        gtfs->spill_end = 0;
     }
     VERBOSE_PRINT(do_verbose, "Success\n"); //On success returns 0.
     return ret;
 }
 
-file_t* gtfs_open_file(gtfs_t* gtfs, string filename, int file_length) {
+file_t* gtfs_open_file(gtfs_t* gtfs, const string& filename, int file_length) {
     if (gtfs) {
         VERBOSE_PRINT(do_verbose, "Opening file " << filename << " inside directory " << gtfs->dirname << "\n");
     } else {
@@ -101,7 +820,7 @@ file_t* gtfs_open_file(gtfs_t* gtfs, string filename, int file_length) {
             VERBOSE_PRINT(do_verbose, "The file length is too short. Data will be lost, aborting\n");
             return NULL;
         }
-        int fd = open(path.c_str(), O_RDWR);
+        int fd = gtfs_sys.open(path.c_str(), O_RDWR, 0);
         if (fcntl(fd, F_SETLK, &lock) == -1) {
             VERBOSE_PRINT(do_verbose, "Another process already opened this file\n");
             return nullptr;
@@ -109,12 +828,11 @@ file_t* gtfs_open_file(gtfs_t* gtfs, string filename, int file_length) {
         map_fs->second->fd = fd;
         map_fs->second->lock = lock;
         if (map_fs->second->file_length < file_length) {
-            if (ftruncate(fd, file_length) == -1) {
+            if (gtfs_sys.ftruncate(fd, file_length) == -1) {
                 VERBOSE_PRINT(do_verbose, "File could not be resized\n");
                 close(fd);
                 return NULL;
             }
-            munmap(map_fs->second->mapped_file, map_fs->second->file_length);
         }
         map_fs->second->mapped_file = mmap(NULL, file_length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
         if (map_fs->second->mapped_file == MAP_FAILED) {
@@ -123,17 +841,19 @@ file_t* gtfs_open_file(gtfs_t* gtfs, string filename, int file_length) {
             return NULL;
         }
         map_fs->second->file_length = file_length;
+        map_fs->second->mapped_length = file_length;
         map_fs->second->flag = getpid();
+        map_fs->second->snapshot->file_length = file_length;
         VERBOSE_PRINT(do_verbose, "Success\n"); // On success returns non NULL.
         return map_fs->second;
     }
-    int fd = open(path.c_str(), O_RDWR | O_CREAT, 0666);
+    int fd = gtfs_sys.open(path.c_str(), O_RDWR | O_CREAT, 0666);
     if (fd == -1) {
         perror("Error opening file");
         return NULL;
     }
 
-    if (ftruncate(fd, file_length) == -1) {
+    if (gtfs_sys.ftruncate(fd, file_length) == -1) {
         perror("Error expanding file size");
         return NULL;
     }
@@ -143,10 +863,45 @@ file_t* gtfs_open_file(gtfs_t* gtfs, string filename, int file_length) {
     fl->filename = path;
     fl->mapped_file = mapped_file;
     fl->file_length = file_length;
+    fl->mapped_length = file_length;
+    fl->fd = fd;
     fl->flag = getpid();
     fl->log_file = fl->filename.substr(0, fl->filename.length() - 4) + "-log.txt";
+    fl->log_ring.buffer = (char*) calloc(GTFS_LOG_RING_SIZE, 1);
+    fl->log_ring.reserved = 0;
+    fl->log_ring.drained = 0;
+    fl->gtfs = gtfs;
+    fl->dirty = 0;
+    fl->log_fd = -1;
+    fl->log_fd_dsync = 0;
+    fl->log_offset = 0;
+    fl->log_generation = 0;
+    fl->log_length = 0;
+    fl->log_error = 0;
+    gtfs_log_find_segments(fl);
+    pthread_mutex_init(&fl->checkpoint_lock, NULL);
+    fl->checkpoint_copied = 0;
+    fl->checkpoint_error = 0;
+    fl->checkpoint_length = 0;
+    fl->checkpoint_src_fd = -1;
+    fl->checkpoint_dest_fd = -1;
+    pthread_mutex_init(&fl->checkpoint_log_lock, NULL);
+    fl->checkpoint_log_copying = 0;
+    fl->checkpoint_log_offset = 0;
+    fl->checkpoint_log_generation = 0;
+    fl->snapshot = gtfs_snapshot_create(fl);
+    if (fl->snapshot == nullptr) {
+        VERBOSE_PRINT(do_verbose, "Snapshot header could not be created\n");
+        munmap(mapped_file, file_length);
+        close(fd);
+        free(fl->log_ring.buffer);
+        delete fl;
+        return NULL;
+    }
 
+    pthread_mutex_lock(&gtfs->flush_lock);
     gtfs->map[filename] = fl;
+    pthread_mutex_unlock(&gtfs->flush_lock);
 
     VERBOSE_PRINT(do_verbose, "Success\n"); //On success returns non NULL.
     return fl;
@@ -161,6 +916,10 @@ int gtfs_close_file(gtfs_t* gtfs, file_t* fl) {
         return ret;
     }
     //TODO: Add any additional initializations and checks, and complete the functionality
+    if (fl->flag <= 0) {
+        VERBOSE_PRINT(do_verbose, "File is not open\n");
+        return ret;
+    }
     if (fcntl(fl->fd, F_UNLCK, &(fl->lock)) == -1) {
         perror( "File cannot be closed because file might not be open\n");
         return -1;
@@ -170,14 +929,28 @@ int gtfs_close_file(gtfs_t* gtfs, file_t* fl) {
         for (auto log_it = fl->log.begin(); log_it != fl->log.end(); ++log_it) {
             write_t* write_step = *log_it;
             if (write_step->synced == 0) {
-                free(write_step->data);
-                free(write_step->overwritten_data);
-                free(write_step);
+                gtfs_free_write_data(write_step);
+                gtfs_delete_write(write_step);
             }
         }
         fl->log.clear();
-        remove(fl->log_file.c_str());
-        open(fl->log_file.c_str(), O_CREAT, 0666);
+        //! The descriptor is about to go away, flush what a later barrier would have needed it for
+        if (gtfs->durability != GTFS_DURABILITY_BUFFERED) {
+            gtfs_barrier(gtfs);
+        }
+        //! The flusher thread must not sync the descriptors while they are closed
+        pthread_mutex_lock(&gtfs->flush_lock);
+        fl->dirty = 0;
+        gtfs_log_truncate(fl);
+        //! Drop the slack left by geometric growth so the file on disk has its logical length
+        if (fl->mapped_length > fl->file_length) {
+            gtfs_sys.ftruncate(fl->fd, fl->file_length);
+        }
+        munmap(fl->mapped_file, fl->mapped_length);
+        fl->mapped_file = nullptr;
+        close(fl->fd);
+        fl->fd = -1;
+        pthread_mutex_unlock(&gtfs->flush_lock);
         VERBOSE_PRINT(do_verbose, "Success\n"); //On success returns 0.
         return 0;
     }
@@ -198,8 +971,17 @@ int gtfs_remove_file(gtfs_t* gtfs, file_t* fl) {
     }
     string pathname = fl->filename;
     if (remove(pathname.c_str()) == 0) {
-        gtfs->map.erase(fl->filename);
-        free(fl);
+        pthread_mutex_lock(&gtfs->flush_lock);
+        gtfs->map.erase(fl->filename.substr(gtfs->dirname.length() + 1));
+        pthread_mutex_unlock(&gtfs->flush_lock);
+        gtfs_log_truncate(fl);
+        for (int index = 0; index < fl->log_segments; index++) {
+            remove(gtfs_log_segment_path(fl, index).c_str());
+        }
+        munmap(fl->snapshot, sizeof(gtfs_snapshot_header_t));
+        remove(gtfs_snapshot_path(fl->filename).c_str());
+        free(fl->log_ring.buffer);
+        delete fl;
         VERBOSE_PRINT(do_verbose, "Success\n"); // On success returns 0.
         return 0;
     }
@@ -233,87 +1015,255 @@ char* gtfs_read_file(gtfs_t* gtfs, file_t* fl, int offset, int length) {
     return ret_data;
 }
 
-write_t* gtfs_write_file(gtfs_t* gtfs, file_t* fl, int offset, int length, const char* data) {
-    write_t *write_id = NULL;
-    if (gtfs and fl) {
-        VERBOSE_PRINT(do_verbose, "Writing " << length << " bytes starting from offset " << offset << " inside file " << fl->filename << "\n");
-    } else {
-        VERBOSE_PRINT(do_verbose, "GTFileSystem or file does not exist\n");
-        return NULL;
+//! Create a single write_t covering all ranges of iov: one redo buffer, one undo buffer and one log record.
+//! Ranges must already be validated against the file.
+static write_t* gtfs_write_ranges(gtfs_t* gtfs, file_t* fl, const gtfs_iovec_t* iov, int iovcnt) {
+    int length = 0;
+    int end = fl->file_length;
+    for (int i = 0; i < iovcnt; i++) {
+        length += iov[i].length;
+        end = max(end, iov[i].offset + iov[i].length);
     }
-
-    //TODO: Add any additional initializations and checks, and complete the functionality
-    if (fl->flag != getpid()) {
-        VERBOSE_PRINT(do_verbose, "This process has not opened this file!\n");
+    if (gtfs_grow_mapping(fl, end) == -1) {
+        VERBOSE_PRINT(do_verbose, "Could not grow file to " << end << " bytes\n");
         return nullptr;
     }
-    if (offset < 0 or length < 0 or offset > fl->file_length) {
-        VERBOSE_PRINT(do_verbose, "Invalid offset or length\n");
+
+    int spill;
+    if (gtfs_reserve_memory(gtfs, length, &spill) == -1) {
         return nullptr;
     }
 
     //! Create the write_id
-    write_id = new write_t;
-    write_id->data = (char *) calloc(length, sizeof(char*));  // Allocate sufficient memory for data
-    write_id->overwritten_data = (char *) calloc(length, sizeof(char*));
-    memcpy(write_id->data, data, length);
-    memcpy(write_id->overwritten_data, ((char*)fl->mapped_file) + offset, length);
-    write_id->mapped_file = fl->mapped_file;
+    write_t* write_id = new write_t;
+    write_id->gtfs = gtfs;
+    write_id->spill_offset = -1;
+    write_id->handle = nullptr;
+    write_id->data = (char *) malloc(length);
+    write_id->overwritten_data = spill ? nullptr : (char *) malloc(length);
+    int pos = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        write_id->ranges.push_back(make_pair(iov[i].offset, iov[i].length));
+        memcpy(write_id->data + pos, iov[i].data, iov[i].length);
+        if (write_id->overwritten_data) {
+            memcpy(write_id->overwritten_data + pos, ((char*)fl->mapped_file) + iov[i].offset, iov[i].length);
+        }
+        pos += iov[i].length;
+    }
+    if (spill) {
+        //! Over budget: keep the undo copy in the scratch file instead of memory
+        if (gtfs->spill_fd < 0) {
+            gtfs->spill_fd = gtfs_sys.open((gtfs->dirname + "/.gtfs-spill").c_str(), O_RDWR | O_CREAT | O_TRUNC, 0666);
+        }
+        bool spilled = gtfs->spill_fd >= 0;
+        pos = 0;
+        for (int i = 0; i < iovcnt and spilled; i++) {
+            spilled = gtfs_sys.pwrite(gtfs->spill_fd, (char*)fl->mapped_file + iov[i].offset, iov[i].length, gtfs->spill_end + pos) == iov[i].length;
+            pos += iov[i].length;
+        }
+        if (!spilled) {
+            VERBOSE_PRINT(do_verbose, "Failed to spill undo data!\n");
+            free(write_id->data);
+            delete write_id;
+            gtfs_release_memory(gtfs, length);
+            return nullptr;
+        }
+        write_id->spill_offset = gtfs->spill_end;
+        gtfs->spill_end += length;
+    }
+    write_id->file = fl;
     write_id->overwritten_length = length;
     write_id->length = length;
-    write_id->offset = offset;
-    write_id->filename = fl->filename;
+    write_id->offset = iovcnt > 0 ? iov[0].offset : 0;
     write_id->synced = 0;
-    write_id->log_file = fl->log_file;
-    write_id->fd = fl->fd;
+    write_id->lsn = 0;
 
     //! Copy the data onto the file
-    memcpy((char*)fl->mapped_file + offset, data, length);
-    if (offset + length > fl->file_length) {
-        fl->file_length = offset + length;
+    for (int i = 0; i < iovcnt; i++) {
+        memcpy((char*)fl->mapped_file + iov[i].offset, iov[i].data, iov[i].length);
     }
+    fl->file_length = end;
     (fl->log).push_back(write_id);
-    VERBOSE_PRINT(do_verbose, "Success\n"); //On success returns non NULL.
     return write_id;
 }
 
-int gtfs_sync_write_file(write_t* write_id) {
-    int ret = -1;
-    if (write_id) {
-        VERBOSE_PRINT(do_verbose, "Persisting write of " << write_id->length << " bytes starting from offset " << write_id->offset << " inside file " << write_id->filename << "\n");
-    } else {
-        VERBOSE_PRINT(do_verbose, "Write operation does not exist\n");
-        return ret;
-    }
-    //TODO: Add any additional initializations and checks, and complete the functionality
-    int fd = open(write_id->filename.c_str(), O_RDWR | O_CREAT, 0666);
-    if (lseek(fd, write_id->offset, SEEK_SET) == -1) {
-        VERBOSE_PRINT(do_verbose, "Failed to lseek!\n");
-        return -1;
+//! Send all of buf over a socket, returns -1 if the peer is gone
+static int gtfs_send_all(int fd, const void* buf, size_t count) {
+#ifdef MSG_NOSIGNAL
+    int flags = MSG_NOSIGNAL;
+#else
+    int flags = 0;
+#endif
+    const char* pos = (const char*) buf;
+    while (count > 0) {
+        ssize_t sent = send(fd, pos, count, flags);
+        if (sent <= 0) {
+            if (sent < 0 and errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        pos += sent;
+        count -= sent;
     }
-    ssize_t written_bytes = write(fd, write_id->data, write_id->length);
-    if (written_bytes < 0) {
-        VERBOSE_PRINT(do_verbose, "Failed to write to the disk memory!\n");
-        return -1;
+    return 0;
+}
+
+//! Replication thread: send queued records to the standby in order until stopped with the queue empty
+static void* gtfs_repl_loop(void* arg) {
+    gtfs_t* gtfs = (gtfs_t*) arg;
+    pthread_mutex_lock(&gtfs->repl_lock);
+    while (true) {
+        while (gtfs->repl_queue.empty() and !gtfs->repl_stop) {
+            pthread_cond_wait(&gtfs->repl_cond, &gtfs->repl_lock);
+        }
+        if (gtfs->repl_queue.empty()) {
+            break;
+        }
+        vector<char> record = std::move(gtfs->repl_queue.front());
+        gtfs->repl_queue.pop_front();
+        gtfs->repl_queued_bytes -= record.size();
+        int fd = gtfs->repl_fd;
+        pthread_mutex_unlock(&gtfs->repl_lock);
+        int sent = gtfs_send_all(fd, record.data(), record.size());
+        pthread_mutex_lock(&gtfs->repl_lock);
+        if (sent == -1) {
+            VERBOSE_PRINT(do_verbose, "Standby is gone, stopping replication\n");
+            close(fd);
+            gtfs->repl_fd = -1;
+            gtfs->repl_queue.clear();
+            gtfs->repl_queued_bytes = 0;
+            break;
+        }
     }
-    fd = open(write_id->log_file.c_str(), O_RDWR | O_CREAT, 0666);
-    if (lseek(fd, 0, SEEK_END) == -1) {
-        VERBOSE_PRINT(do_verbose, "Failed to lseek!\n");
-        close(fd);
-        return -1;
+    pthread_mutex_unlock(&gtfs->repl_lock);
+    return NULL;
+}
+
+//! Receive exactly count bytes from a socket, returns -1 on EOF or error
+static int gtfs_recv_all(int fd, void* buf, size_t count) {
+    char* pos = (char*) buf;
+    while (count > 0) {
+        ssize_t received = recv(fd, pos, count, 0);
+        if (received <= 0) {
+            if (received < 0 and errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        pos += received;
+        count -= received;
     }
-    written_bytes = write(fd, write_id->data, write_id->length);
-    if (written_bytes < 0) {
-        VERBOSE_PRINT(do_verbose, "Failed to write to the disk memory!\n");
-        close(fd);
+    return 0;
+}
+
+//! Persist the first bytes of a write: write them to their ranges in the file and append them to the log
+static int gtfs_persist_write(write_t* write_id, int bytes) {
+    int dsync = write_id->gtfs->durability == GTFS_DURABILITY_DSYNC ? O_DSYNC : 0;
+    int fd = gtfs_sys.open(write_id->file->filename.c_str(), O_RDWR | O_CREAT | dsync, 0666);
+    if (fd == -1) {
+        VERBOSE_PRINT(do_verbose, "Failed to open file!\n");
         return -1;
     }
+    gtfs_checkpoint_begin(write_id, bytes);
+    gtfs_snapshot_begin(write_id->file);
+    int pos = 0;
+    for (auto range = write_id->ranges.begin(); range != write_id->ranges.end() and pos < bytes; ++range) {
+        int length = min(range->second, bytes - pos);
+        if (gtfs_sys.pwrite(fd, write_id->data + pos, length, range->first) != length) {
+            VERBOSE_PRINT(do_verbose, "Failed to write to the disk memory!\n");
+            close(fd);
+            gtfs_snapshot_end(write_id, pos);
+            gtfs_checkpoint_end(write_id);
+            return -1;
+        }
+        pos += length;
+    }
     close(fd);
+    if (gtfs_log_ring_append(write_id->file, write_id->data, bytes) == -1) {
+        gtfs_snapshot_end(write_id, bytes);
+        gtfs_checkpoint_end(write_id);
+        return -1;
+    }
+    return gtfs_commit(write_id, bytes);
+}
+
+//! Drop the first bytes of a write once they are persisted, keeping the rest pending
+static void gtfs_consume_write(write_t* write_id, int bytes) {
+    int left = bytes;
+    while (left > 0 and !write_id->ranges.empty()) {
+        pair<int, int>& range = write_id->ranges.front();
+        int length = min(left, range.second);
+        range.first += length;
+        range.second -= length;
+        left -= length;
+        if (range.second == 0) {
+            write_id->ranges.erase(write_id->ranges.begin());
+        }
+    }
+    long released = bytes;
+    memmove(write_id->data, write_id->data + bytes, write_id->length - bytes);
+    if (write_id->overwritten_data) {
+        memmove(write_id->overwritten_data, write_id->overwritten_data + bytes, write_id->overwritten_length - bytes);
+        released += bytes;
+    } else {
+        write_id->spill_offset += bytes;
+    }
+    write_id->length -= bytes;
+    write_id->overwritten_length -= bytes;
+    write_id->offset = write_id->ranges.empty() ? write_id->offset : write_id->ranges.front().first;
+    gtfs_release_memory(write_id->gtfs, released);
+}
+
+write_t* gtfs_write_file(gtfs_t* gtfs, file_t* fl, int offset, int length, const char* data) {
+    write_t *write_id = NULL;
+    if (gtfs and fl) {
+        VERBOSE_PRINT(do_verbose, "Writing " << length << " bytes starting from offset " << offset << " inside file " << fl->filename << "\n");
+    } else {
+        VERBOSE_PRINT(do_verbose, "GTFileSystem or file does not exist\n");
+        return NULL;
+    }
+
+    //TODO: Add any additional initializations and checks, and complete the functionality
+    if (gtfs->standby) {
+        VERBOSE_PRINT(do_verbose, "GTFileSystem is a read-only standby\n");
+        return nullptr;
+    }
+    if (fl->flag != getpid()) {
+        VERBOSE_PRINT(do_verbose, "This process has not opened this file!\n");
+        return nullptr;
+    }
+    if (offset < 0 or length < 0 or offset > fl->file_length) {
+        VERBOSE_PRINT(do_verbose, "Invalid offset or length\n");
+        return nullptr;
+    }
+    gtfs_iovec_t iov = { offset, length, (char*) data };
+    write_id = gtfs_write_ranges(gtfs, fl, &iov, 1);
+    if (write_id) {
+        VERBOSE_PRINT(do_verbose, "Success\n"); //On success returns non NULL.
+    }
+    return write_id;
+}
+
+int gtfs_sync_write_file(write_t* write_id) {
+    int ret = -1;
+    if (write_id) {
+        VERBOSE_PRINT(do_verbose, "Persisting write of " << write_id->length << " bytes starting from offset " << write_id->offset << " inside file " << write_id->file->filename << "\n");
+    } else {
+        VERBOSE_PRINT(do_verbose, "Write operation does not exist\n");
+        return ret;
+    }
+    //TODO: Add any additional initializations and checks, and complete the functionality
+    //! A budget flush may have synced it already, its data is gone and on disk
+    if (write_id->synced > 0) {
+        VERBOSE_PRINT(do_verbose, "Success\n"); //On success returns number of bytes written.
+        return write_id->length;
+    }
+    if (gtfs_persist_write(write_id, write_id->length) == -1) {
+        return ret;
+    }
     write_id->synced = 1;
-    free(write_id->data);
-    free(write_id->overwritten_data);
-    write_id->data = nullptr;
-    write_id->overwritten_data = nullptr;
+    gtfs_free_write_data(write_id);
     VERBOSE_PRINT(do_verbose, "Success\n"); //On success returns number of bytes written.
     return write_id->length;
 }
@@ -322,18 +1272,29 @@ int gtfs_sync_write_file(write_t* write_id) {
 int gtfs_abort_write_file(write_t* write_id) {
     int ret = -1;
     if (write_id) {
-        VERBOSE_PRINT(do_verbose, "Aborting write of " << write_id->overwritten_length << " bytes starting from offset " << write_id->offset << " inside file " << write_id->filename << "\n");
+        VERBOSE_PRINT(do_verbose, "Aborting write of " << write_id->overwritten_length << " bytes starting from offset " << write_id->offset << " inside file " << write_id->file->filename << "\n");
     } else {
         VERBOSE_PRINT(do_verbose, "Write operation does not exist\n");
         return ret;
     }
     //TODO: Add any additional initializations and checks, and complete the functionality
-    memcpy(((char *)write_id->mapped_file) + write_id->offset, write_id->overwritten_data, write_id->overwritten_length);
+    if (write_id->synced > 0) {
+        VERBOSE_PRINT(do_verbose, "Write is already synced\n");
+        return ret;
+    }
+    int pos = 0;
+    for (auto range = write_id->ranges.begin(); range != write_id->ranges.end(); ++range) {
+        char* dest = ((char *)write_id->file->mapped_file) + range->first;
+        if (write_id->overwritten_data) {
+            memcpy(dest, write_id->overwritten_data + pos, range->second);
+        } else if (pread(write_id->gtfs->spill_fd, dest, range->second, write_id->spill_offset + pos) != range->second) {
+            VERBOSE_PRINT(do_verbose, "Failed to read spilled undo data!\n");
+            return ret;
+        }
+        pos += range->second;
+    }
     write_id->synced = 1;
-    free(write_id->data);
-    free(write_id->overwritten_data);
-    write_id->data = nullptr;
-    write_id->overwritten_data = nullptr;
+    gtfs_free_write_data(write_id);
     VERBOSE_PRINT(do_verbose, "Success.\n"); //On success returns 0.
     return 0;
 }
@@ -351,7 +1312,7 @@ int gtfs_clean_n_bytes(gtfs_t *gtfs, int bytes){
     int save_left = bytes;
     for (auto it = gtfs->map.begin(); it != gtfs->map.end() && save_left > 0; ++it) {
         file_t* value = it->second;
-        for (auto log_it = value->log.begin(); log_it != value->log.end() && save_left > 0; ++log_it) {
+        for (auto log_it = value->log.begin(); log_it != value->log.end() && save_left > 0;) {
             write_t* write_step = *log_it;
             if (write_step->synced <= 0) {
                 if (save_left - write_step->length > 0) {
@@ -363,12 +1324,16 @@ int gtfs_clean_n_bytes(gtfs_t *gtfs, int bytes){
                 }
             }
             if (write_step->synced == 1) {
-                value->log.erase(log_it);
-                free(write_step);
+                log_it = value->log.erase(log_it);
+                gtfs_delete_write(write_step);
+            } else {
+                ++log_it;
             }
         }
-        remove(value->log_file.c_str());
-        open(value->log_file.c_str(), O_CREAT, 0666);
+        if (gtfs->durability != GTFS_DURABILITY_BUFFERED) {
+            gtfs_barrier(gtfs);
+        }
+        gtfs_log_truncate(value);
     }
     VERBOSE_PRINT(do_verbose, "Success\n"); //On success returns 0.
     return ret;
@@ -380,52 +1345,45 @@ int gtfs_clean_n_bytes(gtfs_t *gtfs, int bytes){
 int gtfs_sync_write_file_n_bytes(write_t* write_id, int bytes){
     int ret = -1;
     if (write_id) {
-        VERBOSE_PRINT(do_verbose, "Persisting [ " << bytes << " bytes ] write of " << write_id->length << " bytes starting from offset " << write_id->offset << " inside file " << write_id->filename << "\n");
+        VERBOSE_PRINT(do_verbose, "Persisting [ " << bytes << " bytes ] write of " << write_id->length << " bytes starting from offset " << write_id->offset << " inside file " << write_id->file->filename << "\n");
     } else {
         VERBOSE_PRINT(do_verbose, "Write operation does not exist\n");
         return ret;
     }
-    int fd = open(write_id->filename.c_str(), O_RDWR, 0666);
-    if (lseek(fd, write_id->offset, SEEK_SET) == -1) {
-        VERBOSE_PRINT(do_verbose, "Failed to lseek!\n");
-        return -1;
-    }
-    ssize_t written_bytes = write(fd, write_id->data, bytes);
-    if (written_bytes < 0) {
-        VERBOSE_PRINT(do_verbose, "Failed to write to the disk memory!\n");
-        return -1;
+    if (bytes < 0) {
+        VERBOSE_PRINT(do_verbose, "Invalid number of bytes\n");
+        return ret;
     }
-    fd = open(write_id->log_file.c_str(), O_RDWR | O_CREAT, 0666);
-    if (lseek(fd, 0, SEEK_END) == -1) {
-        VERBOSE_PRINT(do_verbose, "Failed to lseek!\n");
-        close(fd);
-        return -1;
+    if (write_id->synced > 0) {
+        VERBOSE_PRINT(do_verbose, "Success\n"); //On success returns 0.
+        return 0;
     }
-    written_bytes = write(fd, write_id->data, write_id->length);
-    if (written_bytes < 0) {
-        VERBOSE_PRINT(do_verbose, "Failed to write to the disk memory!\n");
-        close(fd);
-        return -1;
+    bytes = min(bytes, write_id->length);
+    if (gtfs_persist_write(write_id, bytes) == -1) {
+        return ret;
     }
-    close(fd);
     if (bytes < write_id->length) {
-        char * new_data = (char *) calloc(write_id->length - bytes, sizeof(char*));  // Allocate sufficient memory for data
-        copy(write_id->data + bytes, write_id->data + write_id->length, new_data);
-        free(write_id->data);
-        write_id->length = write_id->length - bytes;
-        write_id->data = new_data;
+        gtfs_consume_write(write_id, bytes);
     } else {
         write_id->synced = 1;
-        free(write_id->data);
-        free(write_id->overwritten_data);
-        write_id->data = nullptr;
-        write_id->overwritten_data = nullptr;
+        gtfs_free_write_data(write_id);
     }
 
     VERBOSE_PRINT(do_verbose, "Success\n"); //On success returns 0.
     return 0;
 }
 
+long gtfs_get_log_length(file_t * fl) {
+    if (fl) {
+        VERBOSE_PRINT(do_verbose, fl->filename << " log length: " << fl->log_length << "\n");
+    } else {
+        VERBOSE_PRINT(do_verbose, "File does not exist\n");
+        return -1;
+    }
+    gtfs_log_ring_flush(fl);
+    return fl->log_length;
+}
+
 int gtfs_get_file_length(file_t * fl) {
     if (fl) {
         VERBOSE_PRINT(do_verbose, fl->filename << "file length: " << fl->file_length <<"\n");
@@ -436,3 +1394,744 @@ int gtfs_get_file_length(file_t * fl) {
     return fl->file_length;
 }
 
+write_t* gtfs_append_file(gtfs_t* gtfs, file_t* fl, int length, const char* data) {
+    if (gtfs and fl) {
+        VERBOSE_PRINT(do_verbose, "Appending " << length << " bytes to file " << fl->filename << "\n");
+    } else {
+        VERBOSE_PRINT(do_verbose, "GTFileSystem or file does not exist\n");
+        return NULL;
+    }
+    return gtfs_write_file(gtfs, fl, fl->file_length, length, data);
+}
+
+int gtfs_resize_file(gtfs_t* gtfs, file_t* fl, int file_length) {
+    int ret = -1;
+    if (gtfs and fl) {
+        VERBOSE_PRINT(do_verbose, "Resizing file " << fl->filename << " to " << file_length << " bytes\n");
+    } else {
+        VERBOSE_PRINT(do_verbose, "GTFileSystem or file does not exist\n");
+        return ret;
+    }
+    if (gtfs->standby) {
+        VERBOSE_PRINT(do_verbose, "GTFileSystem is a read-only standby\n");
+        return ret;
+    }
+    if (fl->flag != getpid()) {
+        VERBOSE_PRINT(do_verbose, "This process has not opened this file!\n");
+        return ret;
+    }
+    if (fl->file_length > file_length) {
+        VERBOSE_PRINT(do_verbose, "The file length is too short. Data will be lost, aborting\n");
+        return ret;
+    }
+    if (gtfs_grow_mapping(fl, file_length) == -1) {
+        return ret;
+    }
+    fl->file_length = file_length;
+    VERBOSE_PRINT(do_verbose, "Success\n"); //On success returns 0.
+    return 0;
+}
+
+int gtfs_set_memory_budget(gtfs_t* gtfs, long bytes, int backpressure) {
+    int ret = -1;
+    if (gtfs) {
+        VERBOSE_PRINT(do_verbose, "Setting memory budget of " << bytes << " bytes inside directory " << gtfs->dirname << "\n");
+    } else {
+        VERBOSE_PRINT(do_verbose, "GTFileSystem does not exist\n");
+        return ret;
+    }
+    if (bytes < 0 or backpressure < GTFS_BACKPRESSURE_BLOCK or backpressure > GTFS_BACKPRESSURE_SPILL) {
+        VERBOSE_PRINT(do_verbose, "Invalid budget or backpressure policy\n");
+        return ret;
+    }
+    pthread_mutex_lock(&gtfs->mem_lock);
+    gtfs->mem_budget = bytes;
+    gtfs->backpressure = backpressure;
+    pthread_cond_broadcast(&gtfs->mem_cond);
+    pthread_mutex_unlock(&gtfs->mem_lock);
+    VERBOSE_PRINT(do_verbose, "Success\n"); //On success returns 0.
+    return 0;
+}
+
+write_t* gtfs_writev(gtfs_t* gtfs, file_t* fl, const gtfs_iovec_t* iov, int iovcnt) {
+    write_t *write_id = NULL;
+    if (gtfs and fl) {
+        VERBOSE_PRINT(do_verbose, "Writing " << iovcnt << " ranges inside file " << fl->filename << "\n");
+    } else {
+        VERBOSE_PRINT(do_verbose, "GTFileSystem or file does not exist\n");
+        return NULL;
+    }
+    if (gtfs->standby) {
+        VERBOSE_PRINT(do_verbose, "GTFileSystem is a read-only standby\n");
+        return nullptr;
+    }
+    if (fl->flag != getpid()) {
+        VERBOSE_PRINT(do_verbose, "This process has not opened this file!\n");
+        return nullptr;
+    }
+    if (iov == NULL or iovcnt <= 0) {
+        VERBOSE_PRINT(do_verbose, "No ranges to write\n");
+        return nullptr;
+    }
+    //! Every range must start inside the file as extended by the ranges before it
+    int end = fl->file_length;
+    for (int i = 0; i < iovcnt; i++) {
+        if (iov[i].offset < 0 or iov[i].length < 0 or iov[i].offset > end) {
+            VERBOSE_PRINT(do_verbose, "Invalid offset or length\n");
+            return nullptr;
+        }
+        end = max(end, iov[i].offset + iov[i].length);
+    }
+    write_id = gtfs_write_ranges(gtfs, fl, iov, iovcnt);
+    if (write_id) {
+        VERBOSE_PRINT(do_verbose, "Success\n"); //On success returns non NULL.
+    }
+    return write_id;
+}
+
+int gtfs_readv(gtfs_t* gtfs, file_t* fl, gtfs_iovec_t* iov, int iovcnt) {
+    int ret = -1;
+    if (gtfs and fl) {
+        VERBOSE_PRINT(do_verbose, "Reading " << iovcnt << " ranges inside file " << fl->filename << "\n");
+    } else {
+        VERBOSE_PRINT(do_verbose, "GTFileSystem or file does not exist\n");
+        return ret;
+    }
+    if (fl->flag != getpid()) {
+        VERBOSE_PRINT(do_verbose, "This process has not opened this file!\n");
+        return ret;
+    }
+    if (iov == NULL or iovcnt < 0) {
+        VERBOSE_PRINT(do_verbose, "Invalid ranges\n");
+        return ret;
+    }
+    for (int i = 0; i < iovcnt; i++) {
+        if (iov[i].offset < 0 or iov[i].length < 0 or iov[i].offset + iov[i].length > fl->file_length) {
+            VERBOSE_PRINT(do_verbose, "Invalid offset or length\n");
+            return ret;
+        }
+    }
+    int read_bytes = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        memcpy(iov[i].data, (char*)fl->mapped_file + iov[i].offset, iov[i].length);
+        read_bytes += iov[i].length;
+    }
+    VERBOSE_PRINT(do_verbose, "Success\n"); //On success returns number of bytes read.
+    return read_bytes;
+}
+
+int gtfs_replicate(gtfs_t* gtfs, const string& socket_path) {
+    int ret = -1;
+    if (gtfs) {
+        VERBOSE_PRINT(do_verbose, "Replicating GTFileSystem inside directory " << gtfs->dirname << " to standby at " << socket_path << "\n");
+    } else {
+        VERBOSE_PRINT(do_verbose, "GTFileSystem does not exist\n");
+        return ret;
+    }
+    struct sockaddr_un addr;
+    if (socket_path.length() >= sizeof(addr.sun_path)) {
+        VERBOSE_PRINT(do_verbose, "Socket path is too long\n");
+        return ret;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_path.c_str());
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1 or connect(fd, (struct sockaddr*) &addr, sizeof(addr)) == -1) {
+        VERBOSE_PRINT(do_verbose, "Could not connect to standby\n");
+        if (fd != -1) {
+            close(fd);
+        }
+        return ret;
+    }
+    //! Whatever is queued for the previous standby goes out before it is let go
+    if (gtfs->repl_running) {
+        pthread_mutex_lock(&gtfs->repl_lock);
+        gtfs->repl_stop = 1;
+        pthread_cond_signal(&gtfs->repl_cond);
+        pthread_mutex_unlock(&gtfs->repl_lock);
+        pthread_join(gtfs->repl_thread, NULL);
+        gtfs->repl_running = 0;
+    }
+    //! Tell the standby where the stream picks up. No sync is between its file writes and its LSN
+    //! under the checkpoint lock, so every LSN after this one is handed out with repl_fd set and queued.
+    pthread_rwlock_wrlock(&gtfs->checkpoint_lock);
+    pthread_mutex_lock(&gtfs->repl_lock);
+    if (gtfs->repl_fd >= 0) {
+        close(gtfs->repl_fd);
+    }
+    gtfs->repl_stop = 0;
+    gtfs->repl_fd = fd;
+    //! Records queued since the previous thread stopped were meant for the standby it was sending to
+    gtfs->repl_queue.clear();
+    gtfs->repl_queued_bytes = 0;
+    gtfs_repl_record_t hello = { 0, 0, gtfs->committed_lsn.load() };
+    gtfs->repl_queue.push_back(vector<char>((char*) &hello, (char*) &hello + sizeof(hello)));
+    gtfs->repl_queued_bytes += sizeof(hello);
+    pthread_mutex_unlock(&gtfs->repl_lock);
+    pthread_rwlock_unlock(&gtfs->checkpoint_lock);
+    if (pthread_create(&gtfs->repl_thread, NULL, gtfs_repl_loop, gtfs) != 0) {
+        VERBOSE_PRINT(do_verbose, "Could not start the replication thread\n");
+        pthread_mutex_lock(&gtfs->repl_lock);
+        gtfs->repl_fd = -1;
+        gtfs->repl_queue.clear();
+        gtfs->repl_queued_bytes = 0;
+        pthread_mutex_unlock(&gtfs->repl_lock);
+        close(fd);
+        return ret;
+    }
+    gtfs->repl_running = 1;
+    VERBOSE_PRINT(do_verbose, "Success\n"); //On success returns 0.
+    return 0;
+}
+
+//! Find the standby's copy of a file, opening it at no less than its size on disk
+static file_t* gtfs_standby_file(gtfs_t* gtfs, const string& filename, int min_length) {
+    auto map_fs = gtfs->map.find(filename);
+    if (map_fs != gtfs->map.end()) {
+        return map_fs->second;
+    }
+    struct stat st;
+    string path = gtfs->dirname + "/" + filename;
+    if (stat(path.c_str(), &st) == 0 and st.st_size > min_length) {
+        min_length = st.st_size;
+    }
+    return gtfs_open_file(gtfs, filename, min_length);
+}
+
+//! Apply one shipped record to the standby's own files and logs
+static int gtfs_apply_record(gtfs_t* gtfs, int fd) {
+    gtfs_repl_record_t record;
+    if (gtfs_recv_all(fd, &record, sizeof(record)) == -1) {
+        return -1;
+    }
+    //! Nothing from the socket is trusted: a bad record drops the connection
+    if (record.name_length <= 0 or record.name_length > MAX_FILENAME_LEN
+            or record.num_ranges < 0 or record.num_ranges > INT_MAX / (int) sizeof(pair<int, int>)) {
+        VERBOSE_PRINT(do_verbose, "Invalid record header\n");
+        return -1;
+    }
+    //! A record the primary dropped would leave the standby silently behind
+    if (record.lsn != gtfs->repl_lsn + 1) {
+        VERBOSE_PRINT(do_verbose, "Record " << record.lsn << " does not follow " << gtfs->repl_lsn << "\n");
+        return -1;
+    }
+    string name(record.name_length, '\0');
+    vector<pair<int, int>> ranges(record.num_ranges);
+    if (gtfs_recv_all(fd, &name[0], record.name_length) == -1
+            or gtfs_recv_all(fd, ranges.data(), ranges.size() * sizeof(pair<int, int>)) == -1) {
+        return -1;
+    }
+    if (name.find('/') != string::npos or name.find('\0') != string::npos or name == "." or name == "..") {
+        VERBOSE_PRINT(do_verbose, "Invalid file name in record\n");
+        return -1;
+    }
+    long total = 0;
+    int end = 0;
+    for (auto range = ranges.begin(); range != ranges.end(); ++range) {
+        if (range->first < 0 or range->second < 0 or (long) range->first + range->second > INT_MAX) {
+            VERBOSE_PRINT(do_verbose, "Invalid range in record\n");
+            return -1;
+        }
+        total += range->second;
+        end = max(end, range->first + range->second);
+    }
+    if (total > INT_MAX) {
+        VERBOSE_PRINT(do_verbose, "Invalid length in record\n");
+        return -1;
+    }
+    int length = total;
+    vector<char> data(length);
+    if (gtfs_recv_all(fd, data.data(), length) == -1) {
+        return -1;
+    }
+    gtfs->repl_lsn = record.lsn;
+    if (length == 0) {
+        return 0;
+    }
+    vector<gtfs_iovec_t> iov;
+    int pos = 0;
+    for (auto range = ranges.begin(); range != ranges.end(); ++range) {
+        gtfs_iovec_t vec = { range->first, range->second, data.data() + pos };
+        iov.push_back(vec);
+        pos += range->second;
+    }
+
+    pthread_mutex_lock(&gtfs->standby_lock);
+    file_t* fl = gtfs_standby_file(gtfs, name, end);
+    write_t* write_id = fl ? gtfs_write_ranges(gtfs, fl, iov.data(), iov.size()) : nullptr;
+    int ret = write_id ? gtfs_sync_write_file(write_id) : -1;
+    if (write_id) {
+        //! Already durable on the standby, no need to keep it around until the next clean
+        fl->log.pop_back();
+        delete write_id;
+    }
+    pthread_mutex_unlock(&gtfs->standby_lock);
+    return ret < 0 ? -1 : 0;
+}
+
+//! Standby thread: accept a primary and apply its records until promoted
+static void* gtfs_standby_loop(void* arg) {
+    gtfs_t* gtfs = (gtfs_t*) arg;
+    while (gtfs->standby) {
+        int fd = accept(gtfs->standby_listen_fd, NULL, NULL);
+        if (fd == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        gtfs->standby_conn_fd = fd;
+        gtfs_repl_record_t hello;
+        if (gtfs_recv_all(fd, &hello, sizeof(hello)) == -1 or hello.name_length != 0 or hello.num_ranges != 0) {
+            VERBOSE_PRINT(do_verbose, "Invalid stream header\n");
+        } else if (hello.lsn != gtfs->repl_lsn) {
+            VERBOSE_PRINT(do_verbose, "Primary continues after " << hello.lsn << ", standby is at " << gtfs->repl_lsn << "\n");
+        } else {
+            while (gtfs->standby and gtfs_apply_record(gtfs, fd) == 0) {
+            }
+        }
+        VERBOSE_PRINT(do_verbose, "Primary disconnected\n");
+        gtfs->standby_conn_fd = -1;
+        close(fd);
+    }
+    return NULL;
+}
+
+gtfs_t* gtfs_init_standby(const string& directory, const string& socket_path, int verbose_flag) {
+    gtfs_t* gtfs = gtfs_init(directory, verbose_flag);
+    if (gtfs == NULL) {
+        return NULL;
+    }
+    VERBOSE_PRINT(do_verbose, "Starting standby inside directory " << directory << " on " << socket_path << "\n");
+    struct sockaddr_un addr;
+    if (socket_path.length() >= sizeof(addr.sun_path)) {
+        VERBOSE_PRINT(do_verbose, "Socket path is too long\n");
+        return NULL;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_path.c_str());
+    unlink(socket_path.c_str());
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1 or bind(fd, (struct sockaddr*) &addr, sizeof(addr)) == -1 or listen(fd, 1) == -1) {
+        VERBOSE_PRINT(do_verbose, "Could not listen for a primary\n");
+        if (fd != -1) {
+            close(fd);
+        }
+        return NULL;
+    }
+    gtfs->standby_listen_fd = fd;
+    gtfs->standby = 1;
+    if (pthread_create(&gtfs->standby_thread, NULL, gtfs_standby_loop, gtfs) != 0) {
+        VERBOSE_PRINT(do_verbose, "Could not start the standby thread\n");
+        gtfs->standby = 0;
+        close(fd);
+        gtfs->standby_listen_fd = -1;
+        return NULL;
+    }
+    VERBOSE_PRINT(do_verbose, "Success\n"); //On success returns non NULL.
+    return gtfs;
+}
+
+char* gtfs_standby_read_file(gtfs_t* gtfs, const string& filename, int offset, int length) {
+    if (gtfs) {
+        VERBOSE_PRINT(do_verbose, "Reading " << length << " bytes starting from offset " << offset << " inside standby file " << filename << "\n");
+    } else {
+        VERBOSE_PRINT(do_verbose, "GTFileSystem does not exist\n");
+        return NULL;
+    }
+    pthread_mutex_lock(&gtfs->standby_lock);
+    auto map_fs = gtfs->map.find(filename);
+    char* ret_data = map_fs != gtfs->map.end() ? gtfs_read_file(gtfs, map_fs->second, offset, length) : NULL;
+    pthread_mutex_unlock(&gtfs->standby_lock);
+    return ret_data;
+}
+
+int gtfs_promote_standby(gtfs_t* gtfs) {
+    int ret = -1;
+    if (gtfs) {
+        VERBOSE_PRINT(do_verbose, "Promoting standby inside directory " << gtfs->dirname << "\n");
+    } else {
+        VERBOSE_PRINT(do_verbose, "GTFileSystem does not exist\n");
+        return ret;
+    }
+    if (!gtfs->standby) {
+        VERBOSE_PRINT(do_verbose, "GTFileSystem is not a standby\n");
+        return ret;
+    }
+    //! Wake the standby thread up from accept or recv, it stops applying once standby is cleared
+    gtfs->standby = 0;
+    shutdown(gtfs->standby_listen_fd, SHUT_RDWR);
+    int conn_fd = gtfs->standby_conn_fd;
+    if (conn_fd >= 0) {
+        shutdown(conn_fd, SHUT_RDWR);
+    }
+    pthread_join(gtfs->standby_thread, NULL);
+    close(gtfs->standby_listen_fd);
+    gtfs->standby_listen_fd = -1;
+    VERBOSE_PRINT(do_verbose, "Success\n"); //On success returns 0.
+    return 0;
+}
+
+//! Flusher thread: run a barrier whenever flush_interval_ms pass without one while writes are waiting for it
+static void* gtfs_flusher_loop(void* arg) {
+    gtfs_t* gtfs = (gtfs_t*) arg;
+    pthread_mutex_lock(&gtfs->flush_lock);
+    while (!gtfs->flusher_stop) {
+        long wait_ms = gtfs->last_flush_ms + gtfs->flush_interval_ms - gtfs_now_ms();
+        if (wait_ms <= 0) {
+            wait_ms = gtfs->flush_interval_ms;
+            if (gtfs->durable_lsn.load() < gtfs->committed_lsn.load()) {
+                pthread_mutex_unlock(&gtfs->flush_lock);
+                gtfs_barrier(gtfs);
+                pthread_mutex_lock(&gtfs->flush_lock);
+                continue;
+            }
+        }
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += wait_ms / 1000;
+        deadline.tv_nsec += (wait_ms % 1000) * 1000000;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+        pthread_cond_timedwait(&gtfs->flusher_cond, &gtfs->flush_lock, &deadline);
+    }
+    pthread_mutex_unlock(&gtfs->flush_lock);
+    return NULL;
+}
+
+static void gtfs_flusher_stop(gtfs_t* gtfs) {
+    if (!gtfs->flusher_running) {
+        return;
+    }
+    pthread_mutex_lock(&gtfs->flush_lock);
+    gtfs->flusher_stop = 1;
+    pthread_cond_signal(&gtfs->flusher_cond);
+    pthread_mutex_unlock(&gtfs->flush_lock);
+    pthread_join(gtfs->flusher_thread, NULL);
+    gtfs->flusher_running = 0;
+}
+
+int gtfs_set_durability(gtfs_t* gtfs, int durability, long flush_interval_ms, long flush_interval_bytes) {
+    int ret = -1;
+    if (gtfs) {
+        VERBOSE_PRINT(do_verbose, "Setting durability level " << durability << " inside directory " << gtfs->dirname << "\n");
+    } else {
+        VERBOSE_PRINT(do_verbose, "GTFileSystem does not exist\n");
+        return ret;
+    }
+    if (durability < GTFS_DURABILITY_BUFFERED or durability > GTFS_DURABILITY_DSYNC
+            or flush_interval_ms < 0 or flush_interval_bytes < 0) {
+        VERBOSE_PRINT(do_verbose, "Invalid durability level or flush interval\n");
+        return ret;
+    }
+    //! Whatever was committed under the old level is flushed before the new one applies
+    if (gtfs_barrier(gtfs) == -1) {
+        return ret;
+    }
+    gtfs_flusher_stop(gtfs);
+    gtfs->durability = durability;
+    gtfs->flush_interval_ms = flush_interval_ms;
+    gtfs->flush_interval_bytes = flush_interval_bytes;
+    //! Syncs only check the interval when they happen, a gtfs_t that goes idle needs the thread
+    if (durability == GTFS_DURABILITY_PERIODIC and flush_interval_ms > 0) {
+        gtfs->flusher_stop = 0;
+        if (pthread_create(&gtfs->flusher_thread, NULL, gtfs_flusher_loop, gtfs) != 0) {
+            VERBOSE_PRINT(do_verbose, "Could not start the flusher thread\n");
+            return ret;
+        }
+        gtfs->flusher_running = 1;
+    }
+    VERBOSE_PRINT(do_verbose, "Success\n"); //On success returns 0.
+    return 0;
+}
+
+int gtfs_flush(gtfs_t* gtfs) {
+    if (gtfs) {
+        VERBOSE_PRINT(do_verbose, "Flushing GTFileSystem inside directory " << gtfs->dirname << "\n");
+    } else {
+        VERBOSE_PRINT(do_verbose, "GTFileSystem does not exist\n");
+        return -1;
+    }
+    return gtfs_barrier(gtfs);
+}
+
+long gtfs_durable_lsn(gtfs_t* gtfs) {
+    if (!gtfs) {
+        VERBOSE_PRINT(do_verbose, "GTFileSystem does not exist\n");
+        return -1;
+    }
+    return gtfs->durable_lsn;
+}
+
+//! Take the cut of one file, with no sync between its file writes and its LSN
+static int gtfs_checkpoint_cut(gtfs_t* gtfs, const string& filename, file_t* fl, const string& dest, int full) {
+    int src_fd = open(fl->filename.c_str(), O_RDONLY);
+    int dest_fd = gtfs_sys.open((dest + "/" + filename).c_str(), O_RDWR | O_CREAT, 0666);
+    if (src_fd == -1 or dest_fd == -1) {
+        VERBOSE_PRINT(do_verbose, "Failed to open " << filename << " for the checkpoint\n");
+        if (src_fd != -1) {
+            close(src_fd);
+        }
+        if (dest_fd != -1) {
+            close(dest_fd);
+        }
+        return -1;
+    }
+    int length = fl->snapshot->file_length;
+    size_t extents = (length + GTFS_CHECKPOINT_EXTENT - 1) / GTFS_CHECKPOINT_EXTENT;
+    pthread_mutex_lock(&fl->checkpoint_lock);
+    if (!full and fl->checkpoint_copied) {
+        fl->checkpoint_pending.swap(fl->checkpoint_dirty);
+    } else if (gtfs_clone_file(src_fd, dest_fd) == 0) {
+        fl->checkpoint_pending.clear();
+    } else {
+        fl->checkpoint_pending.assign(extents, 1);
+    }
+    fl->checkpoint_pending.resize(min(fl->checkpoint_pending.size(), extents));
+    fl->checkpoint_dirty.clear();
+    fl->checkpoint_length = length;
+    fl->checkpoint_src_fd = src_fd;
+    fl->checkpoint_dest_fd = dest_fd;
+    fl->checkpoint_error = gtfs_sys.ftruncate(dest_fd, length) == -1;
+    pthread_mutex_unlock(&fl->checkpoint_lock);
+
+    //! Every record of a write up to the cut is in the ring. Once drained, the end of the log is the cut;
+    //! the segments are copied after it, appends past that end do not matter and truncation waits.
+    log_ring_t* ring = &fl->log_ring;
+    while (ring->draining.test_and_set(memory_order_acquire)) {
+        sched_yield();
+    }
+    gtfs_log_ring_drain_locked(fl, ring->reserved.load(memory_order_acquire));
+    pthread_mutex_lock(&fl->checkpoint_log_lock);
+    fl->checkpoint_log_copying = 1;
+    fl->checkpoint_log = fl->log_active;
+    fl->checkpoint_log_offset = fl->log_fd != -1 ? fl->log_offset : GTFS_LOG_SEGMENT_SIZE;
+    fl->checkpoint_log_generation = fl->log_generation;
+    ring->draining.clear(memory_order_release);
+    return 0;
+}
+
+//! Copy the log segments of the cut, the last one only up to the end of the log, and mark any other
+//! segment an earlier checkpoint left in dest as free
+static int gtfs_checkpoint_copy_log(gtfs_t* gtfs, file_t* fl, const string& dest) {
+    if (!fl->checkpoint_log_copying) {
+        return 0;
+    }
+    int ret = 0;
+    for (int index = 0; index < fl->log_segments; index++) {
+        string path = gtfs_log_segment_path(fl, index);
+        string dest_path = dest + path.substr(gtfs->dirname.length());
+        auto position = find(fl->checkpoint_log.begin(), fl->checkpoint_log.end(), index);
+        if (position == fl->checkpoint_log.end()) {
+            int to = gtfs_sys.open(dest_path.c_str(), O_RDWR, 0666);
+            if (to != -1) {
+                ret |= gtfs_log_write_header(to, fl->checkpoint_log_generation, GTFS_LOG_SEGMENT_FREE);
+                close(to);
+            }
+            continue;
+        }
+        long length = position + 1 == fl->checkpoint_log.end() ? fl->checkpoint_log_offset : GTFS_LOG_SEGMENT_SIZE;
+        int from = open(path.c_str(), O_RDONLY);
+        int to = gtfs_sys.open(dest_path.c_str(), O_RDWR | O_CREAT, 0666);
+        if (from == -1 or to == -1 or gtfs_copy_range(from, to, 0, length) == -1
+                or gtfs_sys.ftruncate(to, GTFS_LOG_SEGMENT_SIZE) == -1 or gtfs_datasync(to) == -1) {
+            VERBOSE_PRINT(do_verbose, "Failed to copy log segment " << path << "\n");
+            ret = -1;
+        }
+        if (from != -1) {
+            close(from);
+        }
+        if (to != -1) {
+            close(to);
+        }
+    }
+    fl->checkpoint_log.clear();
+    fl->checkpoint_log_copying = 0;
+    pthread_mutex_unlock(&fl->checkpoint_log_lock);
+    return ret == 0 ? 0 : -1;
+}
+
+//! Copy the extents of the cut that no sync saved on its own, then let go of the files
+static int gtfs_checkpoint_copy(file_t* fl) {
+    pthread_mutex_lock(&fl->checkpoint_lock);
+    for (size_t extent = 0; extent < fl->checkpoint_pending.size(); extent++) {
+        if (fl->checkpoint_pending[extent]) {
+            gtfs_checkpoint_extent(fl, extent);
+        }
+        //! Let syncs waiting to overwrite an extent in
+        pthread_mutex_unlock(&fl->checkpoint_lock);
+        pthread_mutex_lock(&fl->checkpoint_lock);
+    }
+    fl->checkpoint_pending.clear();
+    if (fl->checkpoint_src_fd != -1) {
+        close(fl->checkpoint_src_fd);
+        fl->checkpoint_src_fd = -1;
+    }
+    if (fl->checkpoint_dest_fd != -1) {
+        if (gtfs_datasync(fl->checkpoint_dest_fd) == -1) {
+            fl->checkpoint_error = 1;
+        }
+        close(fl->checkpoint_dest_fd);
+        fl->checkpoint_dest_fd = -1;
+    }
+    int ret = fl->checkpoint_error ? -1 : 0;
+    pthread_mutex_unlock(&fl->checkpoint_lock);
+    return ret;
+}
+
+long gtfs_checkpoint(gtfs_t* gtfs, const string& dest) {
+    long ret = -1;
+    if (gtfs) {
+        VERBOSE_PRINT(do_verbose, "Checkpointing GTFileSystem inside directory " << gtfs->dirname << " to " << dest << "\n");
+    } else {
+        VERBOSE_PRINT(do_verbose, "GTFileSystem does not exist\n");
+        return ret;
+    }
+    if (mkdir(dest.c_str(), 0755) == -1 and errno != EEXIST) {
+        VERBOSE_PRINT(do_verbose, "Destination could not be created\n");
+        return ret;
+    }
+    //! Only a destination holding the previous checkpoint can be brought up to date with the dirty extents
+    int full = gtfs->checkpoint_dest != dest;
+    gtfs->checkpoint_dest.clear();
+
+    pthread_rwlock_wrlock(&gtfs->checkpoint_lock);
+    long lsn = gtfs->committed_lsn;
+    int failed = 0;
+    for (auto it = gtfs->map.begin(); it != gtfs->map.end() and !failed; ++it) {
+        failed = gtfs_checkpoint_cut(gtfs, it->first, it->second, dest, full) == -1;
+    }
+    pthread_rwlock_unlock(&gtfs->checkpoint_lock);
+
+    for (auto it = gtfs->map.begin(); it != gtfs->map.end(); ++it) {
+        if (gtfs_checkpoint_copy(it->second) == -1) {
+            failed = 1;
+        }
+        if (gtfs_checkpoint_copy_log(gtfs, it->second, dest) == -1) {
+            failed = 1;
+        }
+    }
+    if (failed) {
+        VERBOSE_PRINT(do_verbose, "Failed\n");
+        return ret;
+    }
+    for (auto it = gtfs->map.begin(); it != gtfs->map.end(); ++it) {
+        it->second->checkpoint_copied = 1;
+    }
+    gtfs->checkpoint_dest = dest;
+    VERBOSE_PRINT(do_verbose, "Success\n"); //On success returns the LSN of the cut.
+    return lsn;
+}
+
+//! Grow a reader's mapping to cover what the writer has published
+static int gtfs_snapshot_remap(gtfs_snapshot_t* snap, int length) {
+    void* mapped = mmap(NULL, length, PROT_READ, MAP_SHARED, snap->fd, 0);
+    if (mapped == MAP_FAILED) {
+        VERBOSE_PRINT(do_verbose, "Memory mapping failed\n");
+        return -1;
+    }
+    if (snap->mapped_length > 0) {
+        munmap(snap->mapped_file, snap->mapped_length);
+    }
+    snap->mapped_file = mapped;
+    snap->mapped_length = length;
+    return 0;
+}
+
+gtfs_snapshot_t* gtfs_open_snapshot(const string& directory, const string& filename) {
+    VERBOSE_PRINT(do_verbose, "Opening a snapshot of " << filename << " inside directory " << directory << "\n");
+    string path = directory + "/" + filename;
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd == -1) {
+        VERBOSE_PRINT(do_verbose, "File does not exist\n");
+        return NULL;
+    }
+    int header_fd = open(gtfs_snapshot_path(path).c_str(), O_RDONLY);
+    if (header_fd == -1) {
+        VERBOSE_PRINT(do_verbose, "File was never opened by a writer\n");
+        close(fd);
+        return NULL;
+    }
+    void* header = mmap(NULL, sizeof(gtfs_snapshot_header_t), PROT_READ, MAP_SHARED, header_fd, 0);
+    close(header_fd);
+    if (header == MAP_FAILED) {
+        VERBOSE_PRINT(do_verbose, "Memory mapping failed\n");
+        close(fd);
+        return NULL;
+    }
+    gtfs_snapshot_t* snap = new gtfs_snapshot_t;
+    snap->filename = path;
+    snap->fd = fd;
+    snap->mapped_file = nullptr;
+    snap->mapped_length = 0;
+    snap->header = (gtfs_snapshot_header_t*) header;
+    VERBOSE_PRINT(do_verbose, "Success\n"); //On success returns non NULL.
+    return snap;
+}
+
+char* gtfs_snapshot_read(gtfs_snapshot_t* snap, int offset, int length, long* lsn) {
+    if (snap) {
+        VERBOSE_PRINT(do_verbose, "Reading " << length << " bytes starting from offset " << offset << " of a snapshot of " << snap->filename << "\n");
+    } else {
+        VERBOSE_PRINT(do_verbose, "Snapshot does not exist\n");
+        return NULL;
+    }
+    if (offset < 0 or length < 0) {
+        VERBOSE_PRINT(do_verbose, "Invalid offset or length\n");
+        return NULL;
+    }
+    gtfs_snapshot_header_t* header = snap->header;
+    char* data = (char*) calloc(length + 1, 1);
+    for (int attempt = 0; attempt < GTFS_SNAPSHOT_RETRIES; attempt++) {
+        uint64_t seq = header->seq.load();
+        if (header->writers.load() > 0) {
+            sched_yield();
+            continue;
+        }
+        int file_length = header->file_length.load();
+        long snapshot_lsn = header->lsn.load();
+        if (offset + length > file_length) {
+            VERBOSE_PRINT(do_verbose, "Read goes past the committed length of the file\n");
+            free(data);
+            return NULL;
+        }
+        if (file_length > snap->mapped_length and gtfs_snapshot_remap(snap, file_length) == -1) {
+            free(data);
+            return NULL;
+        }
+        memcpy(data, (char*) snap->mapped_file + offset, length);
+        //! The copy only counts if no sync touched the file while it was taken
+        atomic_thread_fence(memory_order_acquire);
+        if (header->writers.load() == 0 and header->seq.load() == seq) {
+            if (lsn) {
+                *lsn = snapshot_lsn;
+            }
+            VERBOSE_PRINT(do_verbose, "Success\n"); //On success returns non NULL.
+            return data;
+        }
+    }
+    VERBOSE_PRINT(do_verbose, "Writer kept syncing, no consistent copy could be taken\n");
+    free(data);
+    return NULL;
+}
+
+int gtfs_close_snapshot(gtfs_snapshot_t* snap) {
+    if (snap) {
+        VERBOSE_PRINT(do_verbose, "Closing a snapshot of " << snap->filename << "\n");
+    } else {
+        VERBOSE_PRINT(do_verbose, "Snapshot does not exist\n");
+        return -1;
+    }
+    if (snap->mapped_length > 0) {
+        munmap(snap->mapped_file, snap->mapped_length);
+    }
+    munmap(snap->header, sizeof(gtfs_snapshot_header_t));
+    close(snap->fd);
+    delete snap;
+    VERBOSE_PRINT(do_verbose, "Success\n"); //On success returns 0.
+    return 0;
+}
@@ -12,6 +12,11 @@
 #include <unordered_map>
 #include <fcntl.h>
 #include <vector>
+#include <deque>
+#include <atomic>
+#include <span>
+#include <string_view>
+#include <utility>
 
 using namespace std;
 
@@ -23,40 +28,187 @@ using namespace std;
 #define MAX_FILENAME_LEN 255
 #define MAX_NUM_FILES_PER_DIR 1024
 
+// What gtfs_write_file does when a write does not fit in the memory budget
+#define GTFS_BACKPRESSURE_BLOCK 0 // wait for other writes to be synced or aborted
+#define GTFS_BACKPRESSURE_FAIL  1 // return NULL right away
+#define GTFS_BACKPRESSURE_SPILL 2 // keep the undo copy in a scratch file instead of memory
+
+// How far a synced write has made it to stable storage once gtfs_sync_write_file returns
+#define GTFS_DURABILITY_BUFFERED 0 // page cache only, nothing is flushed
+#define GTFS_DURABILITY_PERIODIC 1 // flushed by a sync once flush_interval_bytes, or by a background thread once flush_interval_ms, have passed since the last flush; 0 turns either off
+#define GTFS_DURABILITY_GROUP    2 // flushed before returning, concurrent syncs share one fdatasync
+#define GTFS_DURABILITY_DSYNC    3 // file writes and log appends are O_DSYNC
+
+// Bytes of log records buffered per file on their way to the log file. Records are 8-byte aligned
+// and start with an 8-byte header (length, ready flag), so a header never wraps around the ring.
+#define GTFS_LOG_RING_SIZE (1 << 18)
+#define GTFS_LOG_RECORD_SIZE(length) ((8 + (unsigned long) (length) + 7) & ~7UL)
+
+// Bytes of records waiting for a slow standby before the primary gives up replicating to it
+#define GTFS_REPL_QUEUE_BYTES (64L << 20)
+
+// Automatic partial flushes start above the high watermark and go down to the low one (percent of budget)
+#define GTFS_MEM_HIGH_WATERMARK 90
+#define GTFS_MEM_LOW_WATERMARK  50
+
 #include <pthread.h>
 
 extern int do_verbose;
 
+// System calls used for file and log I/O. Tests can swap them out to inject failures.
+typedef struct gtfs_syscalls {
+    int (*open)(const char* path, int flags, mode_t mode);
+    ssize_t (*pwrite)(int fd, const void* buf, size_t count, off_t offset);
+    int (*ftruncate)(int fd, off_t length);
+} gtfs_syscalls_t;
+
+extern gtfs_syscalls_t gtfs_sys;
+
+struct file;
+struct gtfs_dir;
+
 typedef struct write {
-    string filename; // dirname + filename?
+    struct file* file; // file written to, for its name, log and mapping
     int offset;
     int length;
     char *data;
     // TODO: Add any additional fields if necessary
     int overwritten_length;
-    void* mapped_file;
     char* overwritten_data;
     int synced;
-    string log_file;
-    int fd;
+    long lsn; // commit order inside the gtfs_t, durable once <= gtfs_durable_lsn(), 0 until synced
+    struct gtfs_dir* gtfs;
+    long spill_offset; // offset of the undo copy in the scratch file, -1 when it is in memory
+    std::vector<pair<int, int>> ranges; // (offset, length) of each range, data holds them back to back
+    struct write** handle; // inside the gtfs::Write holding this write, emptied when the write is freed
 } write_t;
 
+// Logs are split into fixed-size segments, <name>-log-<index>.txt, preallocated when created and
+// recycled once truncated past, so appending never changes a log file's size. A segment starts with
+// a header naming its generation; each record carries the low bits of the generation of the segment
+// it was written in, so records left over from earlier generations are ignored. A free segment keeps
+// the last generation used so that a later process never hands out the same one again.
+#define GTFS_LOG_SEGMENT_SIZE (1 << 20)
+#define GTFS_LOG_MAGIC 0x4754464c // "GTFL"
+#define GTFS_LOG_SEGMENT_FREE 1
+
+typedef struct log_segment_header {
+    uint32_t magic;
+    uint32_t flags;
+    uint64_t generation;
+} log_segment_header_t;
+
+typedef struct log_record_header {
+    uint32_t length;
+    uint32_t generation;
+} log_record_header_t;
+
+// Multi-producer, single-consumer ring of log records. Writers reserve space with a fetch-add on
+// reserved and fill their record in place; whoever holds draining moves completed records, in
+// reservation order, to the log file and advances drained.
+typedef struct log_ring {
+    char* buffer;
+    std::atomic<unsigned long> reserved;
+    std::atomic<unsigned long> drained;
+    std::atomic_flag draining;
+} log_ring_t;
+
+// Published next to each file as <name>-snap.txt and mapped shared, so readers in any process can
+// copy the committed state straight out of the file, which only ever receives synced bytes. A sync
+// holds writers up while it writes to the file and bumps seq once it is done; a copy taken with
+// writers at 0 and seq unchanged across it is consistent.
+#define GTFS_SNAPSHOT_RETRIES (1 << 16)
+
+typedef struct gtfs_snapshot_header {
+    std::atomic<uint64_t> seq;
+    std::atomic<uint32_t> writers;
+    std::atomic<int32_t> file_length; // length covered by synced writes
+    std::atomic<int64_t> lsn;         // committed_lsn once the last sync reflected in the file was done
+} gtfs_snapshot_header_t;
+
+// Checkpoints track synced bytes per extent of this size and copy whole dirty extents
+#define GTFS_CHECKPOINT_EXTENT (1 << 16)
+
 typedef struct file {
     string filename;
     int file_length;
     // TODO: Add any additional fields if necessary
     pid_t flag;
     void* mapped_file;
+    int mapped_length; // capacity of mapped_file and the backing file, >= file_length
     std::vector<write_t*> log;
     int fd;
     struct flock lock;
     string log_file;
+    log_ring_t log_ring;
+    struct gtfs_dir* gtfs;
+    std::atomic<int> dirty; // synced writes not covered by a flush yet
+    std::atomic<int> log_error; // a log append failed, syncs and barriers fail until the log is truncated
+    gtfs_snapshot_header_t* snapshot;
+    // Log segments, only touched by the thread draining log_ring
+    std::vector<int> log_active; // segments holding the log since the last truncation, oldest first
+    std::vector<int> log_free;   // truncated segments ready for reuse
+    int log_segments;            // segment files created so far
+    int log_fd;                  // current segment, the last one in log_active
+    int log_fd_dsync;
+    long log_offset;
+    uint64_t log_generation;
+    long log_length;             // payload bytes logged since the last truncation
+    // Incremental checkpoints, guarded by checkpoint_lock
+    pthread_mutex_t checkpoint_lock;
+    std::vector<char> checkpoint_dirty;   // extents synced since the last checkpoint
+    std::vector<char> checkpoint_pending; // extents the running checkpoint has not copied yet
+    int checkpoint_copied;                // the last checkpoint holds every extent of the file
+    int checkpoint_error;
+    int checkpoint_length;                // committed length at the cut
+    int checkpoint_src_fd;
+    int checkpoint_dest_fd;
+    pthread_mutex_t checkpoint_log_lock; // held while a checkpoint copies the log, truncation waits for it
+    int checkpoint_log_copying;
+    std::vector<int> checkpoint_log;     // log segments as of the cut, oldest first
+    long checkpoint_log_offset;          // end of the log in the last of them
+    uint64_t checkpoint_log_generation;  // last generation handed out as of the cut
 } file_t;
 
-typedef struct gtfs {
+typedef struct gtfs_dir {
     string dirname;
     // TODO: Add any additional fields if necessary
     unordered_map<string, file_t*> map;
+    long mem_budget; // bytes of redo and undo copies allowed in memory, 0 for no limit
+    long mem_used;
+    int backpressure;
+    pthread_mutex_t mem_lock;
+    pthread_cond_t mem_cond;
+    int spill_fd;
+    long spill_end;
+    std::atomic<int> repl_fd; // connection to a standby that committed writes are shipped to, -1 if none
+    pthread_t repl_thread;    // sends repl_queue to the standby, off the sync path
+    int repl_running;
+    int repl_stop;
+    pthread_mutex_t repl_lock;
+    pthread_cond_t repl_cond;
+    std::deque<std::vector<char>> repl_queue; // records committed but not sent yet, in LSN order
+    long repl_queued_bytes;
+    long repl_lsn; // on a standby, LSN of the last record applied, kept across primary connections
+    int standby; // applying writes shipped by a primary, writes through the API are rejected
+    int standby_listen_fd;
+    int standby_conn_fd;
+    pthread_t standby_thread;
+    pthread_mutex_t standby_lock;
+    int durability;
+    long flush_interval_ms;
+    long flush_interval_bytes;
+    std::atomic<long> committed_lsn;
+    std::atomic<long> durable_lsn;
+    std::atomic<long> unflushed_bytes;
+    std::atomic<long> last_flush_ms;
+    pthread_mutex_t flush_lock;       // held by barriers, and while files come and go from map
+    pthread_cond_t flusher_cond;
+    pthread_t flusher_thread;         // flushes an idle gtfs_t under GTFS_DURABILITY_PERIODIC
+    int flusher_running;
+    int flusher_stop;
+    pthread_rwlock_t checkpoint_lock; // held shared by syncs from their file writes to their LSN
+    string checkpoint_dest;           // destination of the last checkpoint, later ones into it are incremental
 } gtfs_t;
 
 
@@ -65,10 +217,10 @@ typedef struct gtfs {
 
 extern unordered_map<string, gtfs_t*> directories;
 
-gtfs_t* gtfs_init(string directory, int verbose_flag);
+gtfs_t* gtfs_init(const string& directory, int verbose_flag);
 int gtfs_clean(gtfs_t *gtfs);
 
-file_t* gtfs_open_file(gtfs_t* gtfs, string filename, int file_length);
+file_t* gtfs_open_file(gtfs_t* gtfs, const string& filename, int file_length);
 int gtfs_close_file(gtfs_t* gtfs, file_t* fl);
 int gtfs_remove_file(gtfs_t* gtfs, file_t* fl);
 
@@ -85,5 +237,210 @@ int gtfs_sync_write_file_n_bytes(write_t* write_id, int bytes);
 // TODO: Add here any additional data structures or API calls
 
 int gtfs_get_file_length(file_t * fl);
+long gtfs_get_log_length(file_t * fl);
+
+write_t* gtfs_append_file(gtfs_t* gtfs, file_t* fl, int length, const char* data);
+int gtfs_resize_file(gtfs_t* gtfs, file_t* fl, int file_length);
+
+int gtfs_set_memory_budget(gtfs_t* gtfs, long bytes, int backpressure);
+
+typedef struct gtfs_iovec {
+    int offset;
+    int length;
+    char* data;
+} gtfs_iovec_t;
+
+write_t* gtfs_writev(gtfs_t* gtfs, file_t* fl, const gtfs_iovec_t* iov, int iovcnt);
+int gtfs_readv(gtfs_t* gtfs, file_t* fl, gtfs_iovec_t* iov, int iovcnt);
+
+// Header of a committed write shipped to a standby, followed by the file name,
+// num_ranges (offset, length) pairs and the data of all ranges back to back.
+// Records are sent in the order of the primary's LSNs. Each connection starts with a header with no
+// name and no ranges carrying the LSN the stream continues after; the standby only takes a stream
+// that continues where it is and records whose LSNs follow each other without a gap, and otherwise
+// drops the primary. Nothing is copied over when replication starts, so a standby only holds the
+// primary's files if both directories were empty and replication started before the first write.
+typedef struct gtfs_repl_record {
+    int name_length;
+    int num_ranges;
+    long lsn;
+} gtfs_repl_record_t;
+
+int gtfs_replicate(gtfs_t* gtfs, const string& socket_path);
+gtfs_t* gtfs_init_standby(const string& directory, const string& socket_path, int verbose_flag);
+char* gtfs_standby_read_file(gtfs_t* gtfs, const string& filename, int offset, int length);
+int gtfs_promote_standby(gtfs_t* gtfs);
+
+int gtfs_set_durability(gtfs_t* gtfs, int durability, long flush_interval_ms, long flush_interval_bytes);
+int gtfs_flush(gtfs_t* gtfs);
+long gtfs_durable_lsn(gtfs_t* gtfs);
+
+// Copies the committed state of every file as of the returned LSN, and their logs, into dest.
+// Checkpoints of one gtfs_t must not overlap.
+long gtfs_checkpoint(gtfs_t* gtfs, const string& dest);
+
+// Read-only view of the committed state of a file, usable from any process while its owner writes
+typedef struct gtfs_snapshot {
+    string filename;
+    int fd;
+    void* mapped_file;
+    int mapped_length;
+    gtfs_snapshot_header_t* header;
+} gtfs_snapshot_t;
+
+gtfs_snapshot_t* gtfs_open_snapshot(const string& directory, const string& filename);
+char* gtfs_snapshot_read(gtfs_snapshot_t* snap, int offset, int length, long* lsn);
+int gtfs_close_snapshot(gtfs_snapshot_t* snap);
+
+// C++ handles over the API above. They are move-only, an empty handle plays the role of a NULL return.
+
+namespace gtfs {
+
+// A write that is neither synced nor aborted when its handle goes away is aborted.
+// Closing or cleaning frees writes; the handle of a freed write is emptied.
+class Write {
+public:
+    Write() noexcept : write_id(nullptr) {}
+    explicit Write(write_t* write_id) noexcept : write_id(write_id) { attach(); }
+    Write(Write&& other) noexcept : write_id(std::exchange(other.write_id, nullptr)) { attach(); }
+    Write& operator=(Write&& other) noexcept {
+        if (this != &other) {
+            abort();
+            write_id = std::exchange(other.write_id, nullptr);
+            attach();
+        }
+        return *this;
+    }
+    Write(const Write&) = delete;
+    Write& operator=(const Write&) = delete;
+    ~Write() { abort(); }
+
+    int sync() {
+        if (!write_id) {
+            return -1;
+        }
+        //! A failed sync leaves the write pending, to retry or abort
+        int ret = gtfs_sync_write_file(write_id);
+        if (ret >= 0) {
+            detach();
+        }
+        return ret;
+    }
+    int sync(int bytes) {
+        if (!write_id) {
+            return -1;
+        }
+        int ret = gtfs_sync_write_file_n_bytes(write_id, bytes);
+        if (write_id->synced) {
+            detach();
+        }
+        return ret;
+    }
+    int abort() {
+        if (!write_id) {
+            return -1;
+        }
+        //! Synced or aborted through the C API in the meantime
+        if (write_id->synced) {
+            detach();
+            return -1;
+        }
+        return gtfs_abort_write_file(detach());
+    }
+
+    write_t* get() const noexcept { return write_id; }
+    explicit operator bool() const noexcept { return write_id != nullptr; }
+
+private:
+    void attach() noexcept {
+        if (write_id) {
+            write_id->handle = &write_id;
+        }
+    }
+    write_t* detach() noexcept {
+        write_id->handle = nullptr;
+        return std::exchange(write_id, nullptr);
+    }
+
+    write_t* write_id;
+};
+
+// Closes the file when the handle goes away. Must not outlive its Directory.
+class File {
+public:
+    File() noexcept : gtfs(nullptr), fl(nullptr) {}
+    File(gtfs_t* gtfs, file_t* fl) noexcept : gtfs(gtfs), fl(fl) {}
+    File(File&& other) noexcept : gtfs(std::exchange(other.gtfs, nullptr)), fl(std::exchange(other.fl, nullptr)) {}
+    File& operator=(File&& other) noexcept {
+        if (this != &other) {
+            close();
+            gtfs = std::exchange(other.gtfs, nullptr);
+            fl = std::exchange(other.fl, nullptr);
+        }
+        return *this;
+    }
+    File(const File&) = delete;
+    File& operator=(const File&) = delete;
+    ~File() { close(); }
+
+    Write write(int offset, std::span<const char> data) {
+        return Write(gtfs_write_file(gtfs, fl, offset, data.size(), data.data()));
+    }
+    Write append(std::span<const char> data) {
+        return Write(gtfs_append_file(gtfs, fl, data.size(), data.data()));
+    }
+    // Reads into a caller-owned buffer, returns the number of bytes read or -1
+    int read(int offset, std::span<char> out) {
+        gtfs_iovec_t iov = { offset, (int) out.size(), out.data() };
+        return gtfs_readv(gtfs, fl, &iov, 1);
+    }
+    int resize(int file_length) { return gtfs_resize_file(gtfs, fl, file_length); }
+    int length() const { return gtfs_get_file_length(fl); }
+    int close() {
+        if (!fl) {
+            return -1;
+        }
+        int ret = gtfs_close_file(gtfs, fl);
+        gtfs = nullptr;
+        fl = nullptr;
+        return ret;
+    }
+
+    file_t* get() const noexcept { return fl; }
+    explicit operator bool() const noexcept { return fl != nullptr; }
+
+private:
+    gtfs_t* gtfs;
+    file_t* fl;
+};
+
+// gtfs_t objects are shared by every gtfs_init of the same directory in a process,
+// so the handle only drops its reference.
+class Directory {
+public:
+    Directory() noexcept : gtfs(nullptr) {}
+    Directory(std::string_view directory, int verbose_flag) : gtfs(gtfs_init(string(directory), verbose_flag)) {}
+    Directory(Directory&& other) noexcept : gtfs(std::exchange(other.gtfs, nullptr)) {}
+    Directory& operator=(Directory&& other) noexcept {
+        gtfs = std::exchange(other.gtfs, nullptr);
+        return *this;
+    }
+    Directory(const Directory&) = delete;
+    Directory& operator=(const Directory&) = delete;
+
+    File open_file(std::string_view filename, int file_length) {
+        return File(gtfs, gtfs_open_file(gtfs, string(filename), file_length));
+    }
+    int clean() { return gtfs_clean(gtfs); }
+    int clean(int bytes) { return gtfs_clean_n_bytes(gtfs, bytes); }
+
+    gtfs_t* get() const noexcept { return gtfs; }
+    explicit operator bool() const noexcept { return gtfs != nullptr; }
+
+private:
+    gtfs_t* gtfs;
+};
+
+} // namespace gtfs
 
 #endif
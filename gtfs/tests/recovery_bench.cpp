@@ -0,0 +1,266 @@
+#include "../src/gtfs.hpp"
+#include <string>
+#include <cstring>
+#include <cerrno>
+#include <chrono>
+#include <signal.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Crash-consistency and recovery-time benchmark.
+// Each trial forks a writer that runs a random workload and either raises SIGKILL on its first I/O call
+// at or after a random op, or is hit by an injected I/O failure. A fresh process then times gtfs_init +
+// gtfs_open_file and checks the recovered file against a reference model built from the writes that
+// were synced.
+
+#define FILE_LEN 4096
+#define MAX_WRITE_LEN 64
+#define NUM_OPS 2000
+
+#define MODE_KILL 0
+#define MODE_FAULT 1
+
+// Assumes files are located within the current directory
+string directory;
+int verbose;
+
+// Shared between the writer, the recoverer and the harness
+typedef struct progress {
+    volatile int done;      // ops [0, done) are finished, synced ones are durable
+    volatile int in_flight; // op whose sync started but did not return yet, -1 if none
+    volatile int fail_after;
+    volatile int kill_at;   // op at which the writer crashes in MODE_KILL
+    volatile long recovery_us;
+    volatile long log_bytes;  // log left behind by the writer, as found by the recoverer
+    volatile int consistent;
+} progress_t;
+
+progress_t *progress;
+
+typedef struct op {
+    int offset;
+    int length;
+    char value;
+    int sync;
+} op_t;
+
+op_t make_op(unsigned int seed, int index) {
+    unsigned int state = seed * 7919 + index;
+    op_t op;
+    op.offset = rand_r(&state) % (FILE_LEN - MAX_WRITE_LEN);
+    op.length = 1 + rand_r(&state) % MAX_WRITE_LEN;
+    op.value = 'a' + index % 26;
+    op.sync = rand_r(&state) % 4 != 0;
+    return op;
+}
+
+// Op the writer is running
+int current_op;
+
+// **Crash injection**: once the writer reaches op kill_at, its next I/O call never happens.
+
+void crash_point() {
+    if (current_op >= progress->kill_at) {
+        raise(SIGKILL);
+    }
+}
+
+int crashing_open(const char* path, int flags, mode_t mode) {
+    crash_point();
+    return open(path, flags, mode);
+}
+
+ssize_t crashing_pwrite(int fd, const void* buf, size_t count, off_t offset) {
+    crash_point();
+    return pwrite(fd, buf, count, offset);
+}
+
+int crashing_ftruncate(int fd, off_t length) {
+    crash_point();
+    return ftruncate(fd, length);
+}
+
+// **Fault injection**: every I/O call fails with EIO once the budget runs out.
+
+int faulty_open(const char* path, int flags, mode_t mode) {
+    progress->fail_after = progress->fail_after - 1;
+    if (progress->fail_after < 0) {
+        errno = EIO;
+        return -1;
+    }
+    return open(path, flags, mode);
+}
+
+ssize_t faulty_pwrite(int fd, const void* buf, size_t count, off_t offset) {
+    progress->fail_after = progress->fail_after - 1;
+    if (progress->fail_after < 0) {
+        errno = EIO;
+        return -1;
+    }
+    return pwrite(fd, buf, count, offset);
+}
+
+int faulty_ftruncate(int fd, off_t length) {
+    progress->fail_after = progress->fail_after - 1;
+    if (progress->fail_after < 0) {
+        errno = EIO;
+        return -1;
+    }
+    return ftruncate(fd, length);
+}
+
+void writer(string filename, unsigned int seed, int mode) {
+    current_op = 0;
+    if (mode == MODE_KILL) {
+        gtfs_sys.open = crashing_open;
+        gtfs_sys.pwrite = crashing_pwrite;
+        gtfs_sys.ftruncate = crashing_ftruncate;
+    } else {
+        gtfs_sys.open = faulty_open;
+        gtfs_sys.pwrite = faulty_pwrite;
+        gtfs_sys.ftruncate = faulty_ftruncate;
+    }
+    gtfs_t *gtfs = gtfs_init(directory, verbose);
+    file_t *fl = gtfs_open_file(gtfs, filename, FILE_LEN);
+    if (fl == NULL) {
+        _exit(1);
+    }
+    char buf[MAX_WRITE_LEN];
+    for (int i = 0; i < NUM_OPS; i++) {
+        current_op = i;
+        op_t op = make_op(seed, i);
+        memset(buf, op.value, op.length);
+        write_t *wrt = gtfs_write_file(gtfs, fl, op.offset, op.length, buf);
+        if (wrt == NULL) {
+            _exit(1);
+        }
+        if (op.sync) {
+            progress->in_flight = i;
+            if (gtfs_sync_write_file(wrt) < 0) {
+                _exit(1); // An I/O error is a crash as far as the model goes
+            }
+            progress->in_flight = -1;
+        }
+        progress->done = i + 1;
+    }
+    if (mode == MODE_KILL) {
+        raise(SIGKILL); // The ops after kill_at did no I/O
+    }
+    _exit(0);
+}
+
+// The durable image is every synced op before done, plus maybe the one whose sync was interrupted
+void build_model(unsigned int seed, int done, int include, char *model) {
+    memset(model, 0, FILE_LEN);
+    for (int i = 0; i < done + include; i++) {
+        op_t op = make_op(seed, i);
+        if (op.sync) {
+            memset(model + op.offset, op.value, op.length);
+        }
+    }
+}
+
+void recoverer(string filename, unsigned int seed) {
+    auto start = chrono::steady_clock::now();
+    gtfs_t *gtfs = gtfs_init(directory, verbose);
+    file_t *fl = gtfs_open_file(gtfs, filename, FILE_LEN);
+    auto end = chrono::steady_clock::now();
+    progress->recovery_us = chrono::duration_cast<chrono::microseconds>(end - start).count();
+    if (fl == NULL) {
+        _exit(1);
+    }
+    progress->log_bytes = gtfs_get_log_length(fl);
+
+    char *data = gtfs_read_file(gtfs, fl, 0, FILE_LEN);
+    char before[FILE_LEN], after[FILE_LEN];
+    build_model(seed, progress->done, 0, before);
+    build_model(seed, progress->done, progress->in_flight == progress->done, after);
+    progress->consistent = data != NULL && (memcmp(data, before, FILE_LEN) == 0 || memcmp(data, after, FILE_LEN) == 0);
+    gtfs_close_file(gtfs, fl);
+    _exit(0);
+}
+
+// Remove the log segments of a file
+void remove_logs(string base) {
+    for (int i = 0; remove((base + "-log-" + to_string(i) + ".txt").c_str()) == 0; i++) {
+    }
+}
+
+int run_trial(int trial, int mode) {
+    unsigned int seed = trial + 1;
+    string filename = "bench" + to_string(trial) + ".txt";
+    string path = directory + "/" + filename;
+    string base = directory + "/bench" + to_string(trial);
+    remove(path.c_str());
+    remove((base + "-snap.txt").c_str());
+    remove_logs(base);
+
+    progress->done = 0;
+    progress->in_flight = -1;
+    progress->fail_after = rand() % (2 * NUM_OPS);
+    progress->kill_at = rand() % NUM_OPS;
+    progress->recovery_us = -1;
+    progress->log_bytes = -1;
+    progress->consistent = 0;
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        exit(-1);
+    }
+    if (pid == 0) {
+        writer(filename, seed, mode);
+    }
+    waitpid(pid, NULL, 0);
+
+    pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        exit(-1);
+    }
+    if (pid == 0) {
+        recoverer(filename, seed);
+    }
+    waitpid(pid, NULL, 0);
+
+    cout << trial << "\t" << (mode == MODE_KILL ? "kill" : "fault") << "\t" << progress->done << "\t"
+         << progress->log_bytes << "\t" << progress->recovery_us << "\t" << (progress->consistent ? "ok" : "CORRUPT") << "\n";
+    remove(path.c_str());
+    remove((base + "-snap.txt").c_str());
+    remove_logs(base);
+    return progress->consistent;
+}
+
+int main(int argc, char **argv) {
+    int trials = 20;
+    if (argc < 2)
+        printf("Usage: ./recovery_bench verbose_flag [trials]\n");
+    else
+        verbose = strtol(argv[1], NULL, 10);
+    if (argc >= 3)
+        trials = strtol(argv[2], NULL, 10);
+
+    // Get current directory path
+    char cwd[256];
+    if (getcwd(cwd, sizeof(cwd)) != NULL) {
+        directory = string(cwd);
+    } else {
+        cout << "[cwd] Something went wrong.\n";
+    }
+
+    progress = (progress_t *) mmap(NULL, sizeof(progress_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (progress == MAP_FAILED) {
+        perror("mmap");
+        exit(-1);
+    }
+    srand(getpid());
+
+    cout << "trial\tmode\tops\tlog_bytes\trecovery_us\tresult\n";
+    int consistent = 0;
+    for (int i = 0; i < trials; i++) {
+        consistent += run_trial(i, i % 2 == 0 ? MODE_KILL : MODE_FAULT);
+    }
+    cout << "Recovered consistently in " << consistent << "/" << trials << " trials: ";
+    consistent == trials ? cout << PASS : cout << FAIL;
+    return consistent == trials ? 0 : 1;
+}